@@ -11,9 +11,11 @@ struct FlatBvhNode
     vec4 max;// 16 byte            16
     int  order;// 4 byte           32
     int  isLeaf;// 4 byte          36
-    int  createdEmpty;// 4 byte    40
-    int  leftOrRight;// 4 byte     44
-    vec4 indices[10];// 32 byte     48
+    int  hitLink;// 4 byte         40
+    int  missLink;// 4 byte        44
+    int  firstIndex;// 4 byte      48
+    int  indexCount;// 4 byte      52
+    int  padding[2];// 8 byte      56
 };
 
 layout(std430, binding=1) buffer TNodes
@@ -21,6 +23,67 @@ layout(std430, binding=1) buffer TNodes
     FlatBvhNode nodes[];
 };
 
+// Precomputed triangles of the leaves: the first vertex, the two edges from it and the unit normal in the w components.
+// Each leaf reads its own [firstIndex, firstIndex + indexCount) range of records.
+struct TriangleRecord
+{
+    vec4 pointA;// xyz: first vertex, w: normal.x
+    vec4 edgeAB;// xyz: first edge,   w: normal.y
+    vec4 edgeAC;// xyz: second edge,  w: normal.z
+};
+
+layout(std430, binding=3) buffer TriangleRecords
+{
+    TriangleRecord triangleRecords[];
+};
+
+// The material of each triangle, in the same order. It is only read for the closest hit.
+layout(std430, binding=4) buffer LeafMaterials
+{
+    uint leafMaterials[];
+};
+
+// Nodes of the BVH4 or BVH8, 8 vec4s per group of four children: minX, minY, minZ, maxX, maxY, maxZ, then the child
+// and the count of each child as int bits. Count 0 is an inner child, > 0 a leaf, -1 an empty slot.
+layout(std430, binding=5) buffer WideNodes
+{
+    vec4 wideNodes[];
+};
+
+// Nodes of the compressed BVH4, 4 uvec4s per node: origin and exponents | qMinX qMinY qMinZ qMaxX |
+// qMaxY qMaxZ child0 child1 | child2 child3 count01 count23. The q values are one byte per child.
+layout(std430, binding=6) buffer CompressedNodes
+{
+    uvec4 compressedNodes[];
+};
+
+// The copies of the model: the transforms of the bottom-level tree that starts at rootNode in the nodes at binding 1.
+struct Instance
+{
+    mat4 worldToObject;
+    mat4 objectToWorld;
+    int rootNode;
+    int padding[3];
+};
+
+layout(std430, binding=7) buffer Instances
+{
+    Instance instances[];
+};
+
+// The top-level tree over the instances, in the same layout as the nodes at binding 1. Its leaves are instance ranges.
+layout(std430, binding=8) buffer TopNodes
+{
+    FlatBvhNode topNodes[];
+};
+
+// Counters of the shadow rays, added up while countShadowRays is set and read back by the CPU.
+layout(std430, binding=9) buffer ShadowCounters
+{
+    uint shadowRays;
+    uint occludedShadowRays;
+};
+
 struct Material{
     vec4 Ka;
     vec4 Kd;
@@ -50,22 +113,32 @@ struct Hit{
     float u, v;
     float t;
     int mat;
+    int triangle;
+    int instance;
 };
 
 uniform Light lights[];
 uniform vec3 camera;
 uniform sampler2D texture1;
+// 2: the binary nodes at binding 1 are traversed, 4 or 8: the wide nodes at binding 5, 1: the compressed nodes at 6.
+uniform int bvhLayout;
+// More than 0: the top-level tree at binding 8 is traversed and the binary tree is entered at each hit instance.
+uniform int instanceCount;
+// 1: every shadow ray is counted at binding 9.
+uniform int countShadowRays;
 
 in vec3 pixel;
 out vec4 FragColor;
 
-Hit rayTriangleIntersect(Ray ray, vec3 pointA, vec3 pointB, vec3 pointC, int matIndex){
+// Only the distance and the barycentric coordinates are computed here, the rest of the hit is filled in for the closest one.
+Hit rayTriangleIntersect(Ray ray, TriangleRecord triangle, int triangleIndex){
 
     Hit hit;
     hit.t=-1;
     float t; float u; float v;
-    vec3 pApB = pointB - pointA;
-    vec3 pApC = pointC - pointA;
+    vec3 pointA = triangle.pointA.xyz;
+    vec3 pApB = triangle.edgeAB.xyz;
+    vec3 pApC = triangle.edgeAC.xyz;
     vec3 vec90 = cross(ray.dir, pApC);
     float determinant = dot(vec90, pApB);
 
@@ -91,124 +164,326 @@ Hit rayTriangleIntersect(Ray ray, vec3 pointA, vec3 pointB, vec3 pointC, int mat
     }
 
     hit.t = dot(pApC, vecQ) * determinantInv;
-    hit.orig=ray.orig+normalize(ray.dir)*hit.t;
-    hit.normal= normalize(cross(pApB, pApC));
 
     hit.u=u;
     hit.v=v;
-    hit.mat=matIndex;
+    hit.triangle=triangleIndex;
 
     return hit;
 }
 
-vec4 getCoordinatefromIndices(float index){
-    return primitiveCoordinates[int(index)];
+vec4 getCoordinatefromIndices(uint index){
+    return primitiveCoordinates[index];
 }
 
-bool rayIntersectWithBox(vec4 boxMin, vec4 boxMax, Ray r) {
-    vec3 invdir = 1.0 / r.dir.xyz;
-    vec3 f = (boxMax.xyz - r.orig.xyz) * invdir;
-    vec3 n = (boxMin.xyz - r.orig.xyz) * invdir;
+// Slab test: the ray enters the box at 'entryT' if it enters before it leaves it and before 'maxT'.
+bool rayIntersectWithBox(vec4 boxMin, vec4 boxMax, Ray ray, vec3 invDir, float maxT, out float entryT) {
+    vec3 n = (boxMin.xyz - ray.orig) * invDir;
+    vec3 f = (boxMax.xyz - ray.orig) * invDir;
 
-    vec3 tmax = f * sign(invdir);
-    vec3 tmin = n * sign(invdir);
+    vec3 tmin = min(n, f);
+    vec3 tmax = max(n, f);
 
-    return tmin.x < tmax.x && tmin.y < tmax.y && tmin.z < tmax.z;
+    entryT = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+    float exitT = min(min(tmax.x, tmax.y), min(tmax.z, maxT));
+    return entryT <= exitT;
 }
 
-Hit traverseBvhNode(Ray ray, FlatBvhNode node){
-    Hit closestHit;
-    closestHit.t=-1;
-    bool hit;
+const float NO_HIT = 3.402823466e+38;
+
+/* The nodes are in depth-first order and link to the node to continue with, so the traversal is one loop without a
+ * stack: on a hit the ray goes on to the first child (a leaf tests its triangles and goes on to its escape node), on a
+ * miss it skips the subtree. The traversal ends at link -1. Only hits closer than 'closestHit' replace it.
+ * With 'anyHit' the traversal ends at the first hit, the occlusion queries only need to know that there is one.
+ */
+void traverseBinaryBvh(Ray ray, int root, inout Hit closestHit, bool anyHit){
     Hit actualHit;
-    int i=0;
 
-    while (i<=nodes.length()) {
-        // If there is a hit and the node is a leaf, then we traverse the traingles of the node to search for intersection.
-        if (nodes[i].isLeaf==1){
-            for (int j=0;j<nodes[i].indices.length();j++){
-                if (mod(nodes[i].indices[j].x, 1)==0 && mod(nodes[i].indices[j].y, 1)==0 && mod(nodes[i].indices[j].z, 1)==0){
-                    vec3 TrianglePointA=getCoordinatefromIndices(nodes[i].indices[j].x).xyz;
-                    vec3 TrianglePointB=getCoordinatefromIndices(nodes[i].indices[j].y).xyz;
-                    vec3 TrianglePointC=getCoordinatefromIndices(nodes[i].indices[j].z).xyz;
+    vec3 invDir = 1.0 / ray.dir;
+    float entryT;
+    int i=root;
 
-                    actualHit=rayTriangleIntersect(ray, TrianglePointA, TrianglePointB, TrianglePointC, int(nodes[i].indices[j].w));
+    while (i!=-1) {
+        float maxT = closestHit.t<0 ? NO_HIT : closestHit.t;
+        if (!rayIntersectWithBox(nodes[i].min, nodes[i].max, ray, invDir, maxT, entryT)){
+            i=nodes[i].missLink;
+            continue;
+        }
 
-                    if (actualHit.t==-1){ continue; }
+        for (int j=nodes[i].firstIndex;j<nodes[i].firstIndex+nodes[i].indexCount;j++){
+            actualHit=rayTriangleIntersect(ray, triangleRecords[j], j);
 
-                    if (actualHit.t>0 && (closestHit.t>actualHit.t || closestHit.t<0)){
-                        closestHit=actualHit;
-                    }
-                }
-            }
-            // If the leaf node is on the left, then we go to its sibling on the right.
-            if (nodes[i].leftOrRight==0){
-                i=i+1;
-                continue;
+            if (actualHit.t==-1){ continue; }
+
+            if (actualHit.t>0 && (closestHit.t>actualHit.t || closestHit.t<0)){
+                closestHit=actualHit;
+                if (anyHit){ return; }
             }
+        }
+        i=nodes[i].hitLink;
+    }
+}
 
-            // If the leaf is on the right, the we go up in the tree hierachy to search a parent node, which has a right sibling.
-            else if (nodes[i].leftOrRight==1){
+/* The same loop over the top-level tree. At an instance the ray is transformed into object space, its direction is not
+ * normalized, so the distance of a hit is the same in both spaces and the closest hit carries over between instances.
+ */
+Hit traverseInstances(Ray ray, bool anyHit){
+    Hit closestHit;
+    closestHit.t=-1;
 
-                int id=int(ceil(i-2)/2);
-                FlatBvhNode parent=nodes[id];
+    vec3 invDir = 1.0 / ray.dir;
+    float entryT;
+    int i=0;
 
-                while (parent.leftOrRight==1){
-                    parent=nodes[int(ceil(parent.order-2)/2)];
-                    if (parent.order==0){
-                        return closestHit;
-                    }
-                }
-                i = parent.order+1;
-                continue;
+    while (i!=-1) {
+        float maxT = closestHit.t<0 ? NO_HIT : closestHit.t;
+        if (!rayIntersectWithBox(topNodes[i].min, topNodes[i].max, ray, invDir, maxT, entryT)){
+            i=topNodes[i].missLink;
+            continue;
+        }
+
+        for (int j=topNodes[i].firstIndex;j<topNodes[i].firstIndex+topNodes[i].indexCount;j++){
+            Ray objectRay;
+            objectRay.orig=(instances[j].worldToObject*vec4(ray.orig, 1)).xyz;
+            objectRay.dir=(instances[j].worldToObject*vec4(ray.dir, 0)).xyz;
+
+            float previousT=closestHit.t;
+            traverseBinaryBvh(objectRay, instances[j].rootNode, closestHit, anyHit);
+            if (closestHit.t!=previousT){
+                closestHit.instance=j;
+                if (anyHit){ return closestHit; }
             }
         }
+        i=topNodes[i].hitLink;
+    }
+    return closestHit;
+}
 
-        hit = rayIntersectWithBox(nodes[i].min, nodes[i].max, ray);
+// WideBvh::shaderStackSize on the CPU, a BVH4, BVH8 or compressed BVH4 that could need a deeper stack is traced in the
+// binary layout.
+const int WIDE_STACK_SIZE = 128;
 
-        // Section for internal nodes.
-        if (hit) {
-            // If there is a hit, then we go deeper in the tree.
-                i=2*i+1;
-                continue;
+// The hit children of a wide node are pushed from the farthest to the nearest, so the nearest one is popped first.
+Hit traverseWideBvh(Ray ray, bool anyHit){
+    Hit closestHit;
+    closestHit.t=-1;
+    Hit actualHit;
 
+    int groups = bvhLayout / 4;
+    vec3 invDir = 1.0 / ray.dir;
+
+    int stackChild[WIDE_STACK_SIZE];
+    int stackCount[WIDE_STACK_SIZE];
+    float stackEntryT[WIDE_STACK_SIZE];
+    int stackSize = 1;
+    stackChild[0] = 0;
+    stackCount[0] = 0;
+    stackEntryT[0] = 0;
+
+    while (stackSize > 0) {
+        stackSize--;
+        int child = stackChild[stackSize];
+        int count = stackCount[stackSize];
+        float maxT = closestHit.t<0 ? NO_HIT : closestHit.t;
+        if (stackEntryT[stackSize] > maxT) {
+            continue;
         }
 
-        else {
-            // If there is no hit and we are at the root node, then exit the traversal.
-            if (nodes[i].order==0){
-                break;
+        if (count > 0) {
+            for (int j=child;j<child+count;j++){
+                actualHit=rayTriangleIntersect(ray, triangleRecords[j], j);
+
+                if (actualHit.t==-1){ continue; }
+
+                if (actualHit.t>0 && (closestHit.t>actualHit.t || closestHit.t<0)){
+                    closestHit=actualHit;
+                    if (anyHit){ return closestHit; }
+                }
             }
+            continue;
+        }
 
-            // If there is no hit and the current node is on the left, we go to the sibling on the right.
-            if (nodes[i].leftOrRight==0) {
-                i=i+1;
-                continue;
+        int base = child * 8 * groups;
+        int hitChildren[8];
+        float hitEntryT[8];
+        int hitCount = 0;
+
+        for (int g = 0; g < groups; g++) {
+            // One slab test for four children.
+            vec4 nearX = (wideNodes[base + g] - ray.orig.x) * invDir.x;
+            vec4 nearY = (wideNodes[base + groups + g] - ray.orig.y) * invDir.y;
+            vec4 nearZ = (wideNodes[base + 2 * groups + g] - ray.orig.z) * invDir.z;
+            vec4 farX = (wideNodes[base + 3 * groups + g] - ray.orig.x) * invDir.x;
+            vec4 farY = (wideNodes[base + 4 * groups + g] - ray.orig.y) * invDir.y;
+            vec4 farZ = (wideNodes[base + 5 * groups + g] - ray.orig.z) * invDir.z;
+
+            vec4 enter = max(max(min(nearX, farX), min(nearY, farY)), max(min(nearZ, farZ), vec4(0.0)));
+            vec4 leave = min(min(max(nearX, farX), max(nearY, farY)), min(max(nearZ, farZ), vec4(maxT)));
+            ivec4 counts = floatBitsToInt(wideNodes[base + 7 * groups + g]);
+
+            for (int k = 0; k < 4; k++) {
+                if (counts[k] < 0 || enter[k] > leave[k]) {
+                    continue;
+                }
+                // Insertion into the hit children, sorted from the farthest to the nearest.
+                int h = hitCount++;
+                while (h > 0 && hitEntryT[h - 1] < enter[k]) {
+                    hitChildren[h] = hitChildren[h - 1];
+                    hitEntryT[h] = hitEntryT[h - 1];
+                    h--;
+                }
+                hitChildren[h] = g * 4 + k;
+                hitEntryT[h] = enter[k];
             }
+        }
+
+        for (int h = 0; h < hitCount && stackSize < WIDE_STACK_SIZE; h++) {
+            int group = hitChildren[h] / 4;
+            int lane = hitChildren[h] % 4;
+            stackChild[stackSize] = floatBitsToInt(wideNodes[base + 6 * groups + group])[lane];
+            stackCount[stackSize] = floatBitsToInt(wideNodes[base + 7 * groups + group])[lane];
+            stackEntryT[stackSize] = hitEntryT[h];
+            stackSize++;
+        }
+    }
+    return closestHit;
+}
+
+vec4 unpackBytes(uint word){
+    return vec4(bitfieldExtract(word, 0, 8), bitfieldExtract(word, 8, 8), bitfieldExtract(word, 16, 8),
+                bitfieldExtract(word, 24, 8));
+}
 
-            // If there is no hit and the current node is on the right, we go up in the tree to search a node, which has got a right sibling.
-            else if (nodes[i].leftOrRight==1){
-                FlatBvhNode parent=nodes[int(ceil(i-2)/2)];
-
-                while (parent.leftOrRight==1){
-                    parent=nodes[int(ceil(parent.order-2)/2)];
-                    if (parent.order==0){
-                        if (parent.order==0){
-                            return closestHit;
-                        }
-                    }
+// The same traversal as traverseWideBvh. The child boxes are decoded as origin + q * 2^exponent, the values the CPU
+// checked to contain the exact boxes.
+Hit traverseCompressedBvh(Ray ray, bool anyHit){
+    Hit closestHit;
+    closestHit.t=-1;
+    Hit actualHit;
+
+    vec3 invDir = 1.0 / ray.dir;
+
+    int stackChild[WIDE_STACK_SIZE];
+    int stackCount[WIDE_STACK_SIZE];
+    float stackEntryT[WIDE_STACK_SIZE];
+    int stackSize = 1;
+    stackChild[0] = 0;
+    stackCount[0] = 0;
+    stackEntryT[0] = 0;
+
+    while (stackSize > 0) {
+        stackSize--;
+        int child = stackChild[stackSize];
+        int count = stackCount[stackSize];
+        float maxT = closestHit.t<0 ? NO_HIT : closestHit.t;
+        if (stackEntryT[stackSize] > maxT) {
+            continue;
+        }
+
+        if (count > 0) {
+            for (int j=child;j<child+count;j++){
+                actualHit=rayTriangleIntersect(ray, triangleRecords[j], j);
+
+                if (actualHit.t==-1){ continue; }
+
+                if (actualHit.t>0 && (closestHit.t>actualHit.t || closestHit.t<0)){
+                    closestHit=actualHit;
+                    if (anyHit){ return closestHit; }
                 }
-                i = parent.order+1;
+            }
+            continue;
+        }
+
+        uvec4 frame = compressedNodes[child * 4];
+        uvec4 qMin = compressedNodes[child * 4 + 1];
+        uvec4 qMaxChildren = compressedNodes[child * 4 + 2];
+        uvec4 childrenCounts = compressedNodes[child * 4 + 3];
+
+        vec3 origin = uintBitsToFloat(frame.xyz);
+        ivec3 exponent = ivec3(bitfieldExtract(int(frame.w), 0, 8), bitfieldExtract(int(frame.w), 8, 8),
+                               bitfieldExtract(int(frame.w), 16, 8));
+        vec3 scale = uintBitsToFloat(uvec3(exponent + 127) << 23);
+
+        vec4 nearX = (origin.x + unpackBytes(qMin.x) * scale.x - ray.orig.x) * invDir.x;
+        vec4 nearY = (origin.y + unpackBytes(qMin.y) * scale.y - ray.orig.y) * invDir.y;
+        vec4 nearZ = (origin.z + unpackBytes(qMin.z) * scale.z - ray.orig.z) * invDir.z;
+        vec4 farX = (origin.x + unpackBytes(qMin.w) * scale.x - ray.orig.x) * invDir.x;
+        vec4 farY = (origin.y + unpackBytes(qMaxChildren.x) * scale.y - ray.orig.y) * invDir.y;
+        vec4 farZ = (origin.z + unpackBytes(qMaxChildren.y) * scale.z - ray.orig.z) * invDir.z;
+
+        vec4 enter = max(max(min(nearX, farX), min(nearY, farY)), max(min(nearZ, farZ), vec4(0.0)));
+        vec4 leave = min(min(max(nearX, farX), max(nearY, farY)), min(max(nearZ, farZ), vec4(maxT)));
+        ivec4 children = ivec4(qMaxChildren.zw, childrenCounts.xy);
+        ivec4 counts = ivec4(bitfieldExtract(int(childrenCounts.z), 0, 16), bitfieldExtract(int(childrenCounts.z), 16, 16),
+                             bitfieldExtract(int(childrenCounts.w), 0, 16), bitfieldExtract(int(childrenCounts.w), 16, 16));
+
+        int hitChildren[4];
+        float hitEntryT[4];
+        int hitCount = 0;
+        for (int k = 0; k < 4; k++) {
+            if (counts[k] < 0 || enter[k] > leave[k]) {
                 continue;
             }
+            int h = hitCount++;
+            while (h > 0 && hitEntryT[h - 1] < enter[k]) {
+                hitChildren[h] = hitChildren[h - 1];
+                hitEntryT[h] = hitEntryT[h - 1];
+                h--;
+            }
+            hitChildren[h] = k;
+            hitEntryT[h] = enter[k];
+        }
+
+        for (int h = 0; h < hitCount && stackSize < WIDE_STACK_SIZE; h++) {
+            stackChild[stackSize] = children[hitChildren[h]];
+            stackCount[stackSize] = counts[hitChildren[h]];
+            stackEntryT[stackSize] = hitEntryT[h];
+            stackSize++;
         }
     }
     return closestHit;
 }
 
+// The first hit with 'anyHit', the closest one without it.
+Hit traverseLayout(Ray ray, bool anyHit){
+    Hit hit;
+    hit.t=-1;
+    if (instanceCount > 0) {
+        hit = traverseInstances(ray, anyHit);
+    } else if (bvhLayout == 2) {
+        traverseBinaryBvh(ray, 0, hit, anyHit);
+    } else if (bvhLayout == 1) {
+        hit = traverseCompressedBvh(ray, anyHit);
+    } else {
+        hit = traverseWideBvh(ray, anyHit);
+    }
+    return hit;
+}
 
 Hit traverseBvhTree(Ray ray){
-    return traverseBvhNode(ray, nodes[0]);
+    Hit closestHit = traverseLayout(ray, false);
+
+    if (closestHit.t>0){
+        TriangleRecord triangle=triangleRecords[closestHit.triangle];
+        closestHit.orig=ray.orig+normalize(ray.dir)*closestHit.t;
+        closestHit.normal=vec3(triangle.pointA.w, triangle.edgeAB.w, triangle.edgeAC.w);
+        if (instanceCount > 0){
+            // Normals go back to world space with the inverse transpose of the object to world transform.
+            closestHit.normal=normalize(transpose(mat3(instances[closestHit.instance].worldToObject))*closestHit.normal);
+        }
+        closestHit.mat=int(leafMaterials[closestHit.triangle]);
+    }
+    return closestHit;
+}
+
+// Whether the shadow ray hits any triangle. It stops at the first one instead of looking for the closest.
+bool isOccluded(Ray shadowRay){
+    bool occluded = traverseLayout(shadowRay, true).t>0;
+    if (countShadowRays == 1){
+        atomicAdd(shadowRays, 1u);
+        if (occluded){ atomicAdd(occludedShadowRays, 1u); }
+    }
+    return occluded;
 }
 
 vec3 Fresnel(vec3 F0, float cosTheta) {
@@ -242,7 +517,7 @@ vec3 trace(Ray ray){
 
         // Diffuse light
         float cosTheta = dot(hit.normal, normalize(lights[0].direction));// Lambert-féle cosinus törvény alapján.
-        if (cosTheta>0 && traverseBvhTree(shadowRay).t<0) {
+        if (cosTheta>0 && !isOccluded(shadowRay)) {
 
             color +=lights[0].Le * materials[hit.mat].Kd.xyz * cosTheta * weight;
 
@@ -0,0 +1,20 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_ALLOCATIONCOUNTER_H
+#define RAYTRACERBOROS_ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+
+/* Counts the calls of the global operator new when the project is configured with -DCOUNT_ALLOCATIONS=ON.
+ * It is used to measure how many heap allocations the BVH build makes.
+ */
+class AllocationCounter {
+public:
+    static bool isEnabled();
+
+    static size_t getNumberOfAllocations();
+};
+
+#endif //RAYTRACERBOROS_ALLOCATIONCOUNTER_H
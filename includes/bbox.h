@@ -8,6 +8,7 @@
 #include "glm/vec3.hpp"
 #include "glm/vec4.hpp"
 #include <vector>
+#include "buildprimitives.h"
 
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
 #define MAX(A, B) ((A) > (B) ? (A) : (B))
@@ -21,18 +22,26 @@ private:
     glm::vec3 max;
     glm::vec3 center;
     int longestAxis;
-    vector<glm::vec3> faceCenters;
+
+    static void reduceRange(const BuildPrimitives &primitives, int begin, int end, glm::vec3 &minp, glm::vec3 &maxp,
+                            glm::vec3 &centerSum);
 
 public:
     BBox()=default;
 
-    BBox(glm::vec3 min, glm::vec3 max, glm::vec3 center, vector<glm::vec3> faceCenters);
+    BBox(glm::vec3 min, glm::vec3 max, glm::vec3 center);
 
     glm::vec3 calculateCenterofTriangle(glm::vec3 vec, glm::vec3 vec1, glm::vec3 vec2);
 
-    glm::vec3 getCoordinatesfromIndex(float index);
+    glm::vec3 getCoordinatesfromIndex(unsigned int index);
+
+    // Bounds of the triangles in the [begin, end) range of the build order. With taskCount > 1 the bounds and
+    // the centroids are reduced on that many threads, the calling thread is one of them.
+    static BBox getBBox(const BuildPrimitives &primitives, int begin, int end, int taskCount = 1);
+
+    float getSurfaceArea() const;
 
-    BBox getBBox(vector<glm::vec4> &indices);
+    static float getSurfaceArea(const glm::vec3 &min, const glm::vec3 &max);
 
     static const vector<glm::vec4> &getPrimitiveCoordinates();
 
@@ -52,10 +61,6 @@ public:
 
     void setLongestAxis(int longestAxis);
 
-    const vector<glm::vec3> &getFaceCenters() const;
-
-    void setFaceCenters(const vector<glm::vec3> &faceCenters);
-
 };
 
 #endif //RAYTRACERBOROS_BBOX_CPP
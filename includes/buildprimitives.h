@@ -0,0 +1,32 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_BUILDPRIMITIVES_H
+#define RAYTRACERBOROS_BUILDPRIMITIVES_H
+
+#include <vector>
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+
+using namespace std;
+
+/* The bounds and the centroids of the triangles are computed only once before the build. The builder partitions
+ * 'triangleOrder' in place and every node works on its own [begin, end) range of it, so no triangle lists are copied.
+ */
+struct BuildPrimitives {
+    const vector<glm::uvec3> *indices;
+    vector<glm::vec3> centroids;
+    vector<glm::vec3> minBounds;
+    vector<glm::vec3> maxBounds;
+    vector<int> triangleOrder;
+
+    BuildPrimitives(const vector<glm::uvec3> &indices, const vector<glm::vec4> &coordinates, int taskCount);
+
+    int size() const;
+
+private:
+    void computeRange(const vector<glm::vec4> &coordinates, int begin, int end);
+};
+
+#endif //RAYTRACERBOROS_BUILDPRIMITIVES_H
@@ -0,0 +1,108 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_BVHCACHE_H
+#define RAYTRACERBOROS_BVHCACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "flatbvhnode.h"
+#include "model.h"
+#include "settings.h"
+#include "trianglerecord.h"
+
+using namespace std;
+
+/* Binary cache of the built scene next to the model file: the vertex positions, the triangles and their materials in
+ * the order of the leaves, the materials, the flat tree and the triangle records. The header holds a key hashed from
+ * the model file, its material libraries and the settings that change the tree, so an edited model or another builder
+ * misses the cache. A hit is memory-mapped, the sections are read straight from the mapping.
+ */
+class BvhCache {
+public:
+    enum Section {
+        Positions,
+        Triangles,
+        TriangleMaterials,
+        Materials,
+        Nodes,
+        Records,
+        SectionCount
+    };
+
+    struct SectionData {
+        const void *data;
+        uint64_t count;
+        uint32_t elementSize;
+    };
+
+    BvhCache();
+
+    ~BvhCache();
+
+    BvhCache(const BvhCache &) = delete;
+
+    BvhCache &operator=(const BvhCache &) = delete;
+
+    static uint64_t computeKey(const Settings &settings);
+
+    static string getCachePath(const string &modelPath);
+
+    // Maps the cache file, false if it is missing, of another version or its key is not 'key'.
+    bool open(const string &path, uint64_t key);
+
+    // Copies a section of the mapped file, false if its elements are not of type T.
+    template<typename T>
+    bool copySection(Section section, vector<T> &target) const;
+
+    // Copies all sections of the mapped file into the scene, false if one of them has elements of another type.
+    bool readScene(Model &model, vector<FlatBvhNode> &flatNodes, vector<TriangleRecord> &leafRecords) const;
+
+    // Writes the sections into a temporary file and renames it, so a cache file is always complete.
+    static bool write(const string &path, uint64_t key, const SectionData (&sections)[SectionCount]);
+
+    // Writes the model in the order of the leaves with its flat tree and triangle records.
+    static bool writeScene(const string &path, uint64_t key, const Model &model, const vector<FlatBvhNode> &flatNodes,
+                           const vector<TriangleRecord> &leafRecords);
+
+private:
+    static const uint32_t version = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t sectionCount;
+        uint64_t key;
+        uint64_t offsets[SectionCount];
+        uint64_t counts[SectionCount];
+        uint32_t elementSizes[SectionCount];
+    };
+
+    void *mapping;
+    size_t mappingSize;
+    const Header *header;
+
+    // 64 bit FNV-1a over 8 byte words, the tail bytes one by one.
+    static uint64_t hashBytes(const void *data, size_t size, uint64_t hash);
+
+    static uint64_t hashFile(const string &path, uint64_t hash);
+
+    void close();
+};
+
+template<typename T>
+bool BvhCache::copySection(Section section, vector<T> &target) const {
+    if (header == nullptr || header->elementSizes[section] != sizeof(T)) {
+        return false;
+    }
+    target.resize(header->counts[section]);
+    if (!target.empty()) {
+        memcpy(target.data(), (const char *) mapping + header->offsets[section], target.size() * sizeof(T));
+    }
+    return true;
+}
+
+#endif //RAYTRACERBOROS_BVHCACHE_H
@@ -11,6 +11,10 @@
 #include <deque>
 
 #include "bbox.h"
+#include "settings.h"
+#include "lbvh.h"
+#include "ray.h"
+#include "bvhnodearena.h"
 #include "glm/glm.hpp"
 #include "glm/vec3.hpp"
 
@@ -27,43 +31,63 @@ private:
     int depthOfNode;
     int order;
     bool isLeaf;
-    bool createdEmpty;
     int leftOrRight;
 
-    vector<BvhNode *> children;
-    vector<glm::vec4> indices;
+    // The children come from the arena of the tree, a node does not own them. Both are null for a leaf.
+    BvhNode *children[2] = {nullptr, nullptr};
+    // The triangles of a leaf are the [firstIndex, firstIndex + indexCount) range of the triangle index list.
+    int firstIndex = 0;
+    int indexCount = 0;
 
-    int countNodes();
+    void buildSubtree(BuildPrimitives &primitives, int begin, int end, int depth, const BvhSettings &settings,
+                      BvhNodeArena &arena);
 
-    int getNumberOfNodes();
+    void makeLeaf(int begin, int end);
 
-    int getNumberOfLeaves();
+    void buildLinearTree(BuildPrimitives &primitives, const BvhSettings &settings, BvhNodeArena &arena);
 
-    int findDeep(int &deepest);
+    // Converts the subtree of the linear BVH below 'lbvhNode' that covers the [first, last] range of the sorted triangles.
+    void emitLinearSubtree(const vector<LbvhNode> &lbvhNodes, BuildPrimitives &primitives, int first, int last,
+                           int lbvhNode, int depth, const BvhSettings &settings, BvhNodeArena &arena);
 
-    int getDeepestLevel();
+    void assignOrder(int &nextOrder);
 
-    void treeComplete(int deepestLev);
+    int findLargestLeaf() const;
+
+    // The split functions partition the [begin, end) range in place and return the first position of the right child.
+    int splitAtAverageCentroid(BuildPrimitives &primitives, int begin, int end);
+
+    int splitWithBinnedSah(BuildPrimitives &primitives, int begin, int end, const BvhSettings &settings);
+
+    float accumulateSahCost(const BvhSettings &settings) const;
+
+    float accumulateSiblingOverlap() const;
+
+    void traverseForStatistics(const Ray &ray, const vector<glm::uvec3> &triangles, const vector<int> &triangleIndices,
+                               float &closestT, int &visitedNodes, int &testedTriangles) const;
 
 public:
 
+    // A copy shares the children, the nodes of a tree live as long as its arena.
     BvhNode() = default;
 
-    ~BvhNode();
-    
-    //Copy constructor
-    BvhNode(const BvhNode &other);
+    // The subtrees of large nodes are built on worker threads, so the recursion doesn't touch shared state.
+    // The order of the nodes and the largest leaf are determined after the build. The nodes below this one are
+    // allocated from 'arena'.
+    // Returns the triangle index list the leaves point into, it holds positions in 'indices'.
+    vector<int> buildTree(const vector<glm::uvec3> &indices, const BvhSettings &settings, BvhNodeArena &arena);
 
-    friend void swap(BvhNode &first, BvhNode &second);
+    // Expected cost of a ray traversing the tree: the node costs are weighted by their surface area relative to the root.
+    float getSahCost(const BvhSettings &settings) const;
 
-    //Copy assigment operator
-    BvhNode &operator=(BvhNode );
+    // Sum of the surface areas where the boxes of the sibling nodes overlap, relative to the surface of the root.
+    float getSiblingOverlap() const;
 
-    void buildTree(vector<glm::vec4> &indices, int depth);
+    // Closest-hit traversal on the CPU that counts the visited nodes and the tested triangles of one ray.
+    void traceForStatistics(const Ray &ray, const vector<glm::uvec3> &triangles, const vector<int> &triangleIndices,
+                            float &closestT, int &visitedNodes, int &testedTriangles) const;
 
-    void makeBvHTreeComplete();
-
-    void InfoAboutNode();
+    int countSubtreeNodes() const;
 
     const BBox &getBBox() const;
 
@@ -73,9 +97,10 @@ public:
 
     void setDepthOfNode(int depthOfNode);
 
-    const vector<BvhNode *> &getChildren() const;
+    // Child 0 or 1 of an inner node.
+    BvhNode *getChild(int i) const;
 
-    void setChildren(const vector<BvhNode *> &children);
+    void setChildren(BvhNode *left, BvhNode *right);
 
     int getOrder() const;
 
@@ -85,17 +110,17 @@ public:
 
     void setIsLeaf(bool isLeaf);
 
-    bool isCreatedEmpty() const;
-
-    void setCreatedEmpty(bool createdEmpty);
-
     int getLeftOrRight() const;
 
     void setLeftOrRight(int leftOrRight);
 
-    const vector<glm::vec4> &getIndices() const;
+    int getFirstIndex() const;
+
+    void setFirstIndex(int firstIndex);
+
+    int getIndexCount() const;
 
-    void setIndices(const vector<glm::vec4> &indices);
+    void setIndexCount(int indexCount);
 
     static const int &getNumberOfPolygonsInModel();
 
@@ -0,0 +1,54 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_BVHNODEARENA_H
+#define RAYTRACERBOROS_BVHNODEARENA_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+class BvhNode;
+
+/* Bump allocator of the build nodes. The nodes are cut from large blocks, the two children of a node next to each
+ * other, and are never freed one by one: the nodes don't own their children, the whole tree goes away with the arena,
+ * one free per block. The builders running on several threads share the arena, a block is cut under a lock.
+ */
+class BvhNodeArena {
+private:
+    size_t blockSize;
+    // Raw storage, the nodes have trivial destructors and are not destroyed one by one.
+    vector<unique_ptr<char[]>> blocks;
+    size_t usedInBlock;
+    size_t capacityOfBlock;
+    size_t allocatedNodes;
+    size_t reservedNodes;
+    mutex allocationMutex;
+
+public:
+    explicit BvhNodeArena(size_t blockSize = 4096);
+
+    ~BvhNodeArena();
+
+    BvhNodeArena(const BvhNodeArena &) = delete;
+
+    BvhNodeArena &operator=(const BvhNodeArena &) = delete;
+
+    // 'count' default-initialized nodes next to each other.
+    BvhNode *allocate(int count);
+
+    // Makes sure the next 'count' nodes come from one block, e.g. the 2n - 1 nodes of a tree over n triangles.
+    void reserve(size_t count);
+
+    // Frees every node of the arena at once.
+    void release();
+
+    size_t getAllocatedNodes() const;
+
+    size_t getReservedBytes() const;
+};
+
+#endif //RAYTRACERBOROS_BVHNODEARENA_H
@@ -0,0 +1,88 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_BVHSTATISTICS_H
+#define RAYTRACERBOROS_BVHSTATISTICS_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "bvhnode.h"
+#include "settings.h"
+#include "widebvh.h"
+
+using namespace std;
+
+/* Quality report of a built tree, collected in one walk over it: node and leaf counts, the SAH cost, the surface where
+ * siblings overlap, the histograms of the leaf sizes and of the leaf depths, the empty leaves, and the memory of every
+ * layout the tree is stored in. Printed for reading or as JSON, so the runs of two builders can be diffed.
+ */
+class BvhStatistics {
+private:
+    // Memory of one stored form of the tree, empty slots are the unused children of wide nodes and the empty leaves.
+    struct Footprint {
+        string name;
+        size_t nodeCount;
+        size_t bytes;
+        size_t emptySlots;
+    };
+
+    string builderName;
+    double buildTime;
+    int nodeCount;
+    int leafCount;
+    int emptyLeafCount;
+    int deepestLevel;
+    long triangleReferences;
+    int triangleCount;
+    float sahCost;
+    float siblingOverlap;
+    float nodesPerRay;
+    float trianglesPerRay;
+    // leafSizeHistogram[n] is the number of leaves with n triangles, leafDepthHistogram[d] of the leaves at depth d.
+    vector<int> leafSizeHistogram;
+    vector<int> leafDepthHistogram;
+    vector<Footprint> footprints;
+
+    void printText(ostream &out) const;
+
+    void printJson(ostream &out) const;
+
+public:
+    BvhStatistics();
+
+    // Walks the tree once. 'triangleCount' is the number of triangles of the model, the references of the split BVH
+    // can be more.
+    static BvhStatistics collect(const BvhNode &root, const BvhSettings &settings, int triangleCount,
+                                 double buildTime);
+
+    // Adds a stored layout to the memory report, e.g. the flat binary nodes or the wide nodes.
+    void addFootprint(const string &name, size_t nodeCount, size_t nodeSize, size_t emptySlots);
+
+    // The primary ray measurement of the traversal, it goes into the report as well.
+    void setTraversalCost(float nodesPerRay, float trianglesPerRay);
+
+    // The unused child slots of the wide nodes.
+    template<int Width>
+    static size_t countEmptySlots(const vector<WideBvhNode<Width>> &nodes);
+
+    void print(ostream &out, StatisticsFormat format) const;
+
+    float getSahCost() const;
+
+    float getSiblingOverlap() const;
+};
+
+template<int Width>
+size_t BvhStatistics::countEmptySlots(const vector<WideBvhNode<Width>> &nodes) {
+    size_t emptySlots = 0;
+    for (const WideBvhNode<Width> &node : nodes) {
+        for (int i = 0; i < Width; i++) {
+            emptySlots += node.count[i] < 0;
+        }
+    }
+    return emptySlots;
+}
+
+#endif //RAYTRACERBOROS_BVHSTATISTICS_H
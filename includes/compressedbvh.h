@@ -0,0 +1,61 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_COMPRESSEDBVH_H
+#define RAYTRACERBOROS_COMPRESSEDBVH_H
+
+#include <cstdint>
+#include <vector>
+#include "glm/glm.hpp"
+#include "widebvh.h"
+
+using namespace std;
+
+/* Node of a BVH4 in one 64 byte cache line. The bounds of the children are 8 bit offsets in a frame that covers all of
+ * them: child min = origin + qMin * 2^exponent per axis, the same for max. The offsets are rounded outwards, so the
+ * decoded boxes contain the exact ones. Children are the same as in WideBvhNode<4>, count is -1 for an empty slot.
+ *
+ * In the shader the node is 4 uvec4s: origin and exponents | qMinX qMinY qMinZ qMaxX | qMaxY qMaxZ child0 child1 |
+ * child2 child3 count01 count23.
+ */
+struct CompressedBvhNode {
+    float originX, originY, originZ;    // 12 bytes
+    int8_t exponentX, exponentY, exponentZ;
+    uint8_t padding;                    // 4 bytes
+    uint8_t qMinX[4];
+    uint8_t qMinY[4];
+    uint8_t qMinZ[4];
+    uint8_t qMaxX[4];
+    uint8_t qMaxY[4];
+    uint8_t qMaxZ[4];                   // 24 bytes
+    int32_t child[4];                   // 16 bytes
+    int16_t count[4];                   // 8 bytes
+};
+
+static_assert(sizeof(CompressedBvhNode) == 64, "A compressed node has to fit in one cache line.");
+
+class CompressedBvh {
+public:
+    // One compressed node for every node of the BVH4, in the same order. It is empty if a leaf has too many triangles
+    // for the 16 bit count.
+    static vector<CompressedBvhNode> compress(const vector<WideBvhNode<4>> &wideNodes);
+
+    static WideBvhNode<4> decode(const CompressedBvhNode &node);
+
+    // Closest-hit traversal on the CPU, every visited node is decoded before its boxes are tested.
+    static void traceForStatistics(const vector<CompressedBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                                   const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles);
+
+private:
+    static CompressedBvhNode compressNode(const WideBvhNode<4> &wideNode);
+
+    // The smallest exponent with which 255 steps reach from 'low' to 'high'.
+    static int findExponent(float low, float high);
+
+    static uint8_t quantizeMin(float value, float origin, float scale);
+
+    static uint8_t quantizeMax(float value, float origin, float scale);
+};
+
+#endif //RAYTRACERBOROS_COMPRESSEDBVH_H
@@ -0,0 +1,143 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_CPUTRACER_H
+#define RAYTRACERBOROS_CPUTRACER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "glm/glm.hpp"
+#include "flatbvhnode.h"
+#include "trianglerecord.h"
+#include "mesh.h"
+#include "light.h"
+#include "raypacket.h"
+#include "triangleblocks.h"
+
+using namespace std;
+
+// The Hit of the shader: the closest hit of a ray with its point, normal, texture coordinates and material.
+struct CpuHit {
+    glm::vec3 orig;
+    glm::vec3 normal;
+    float u;
+    float v;
+    float t;
+    int mat;
+    int triangle;
+};
+
+// The rays the renderer traced. The shadow rays are occlusion queries, the occluded ones stop at the first triangle
+// that blocks the light instead of looking for the closest one.
+struct RayCounters {
+    long rays = 0;
+    long shadowRays = 0;
+    long occludedShadowRays = 0;
+    // The nodes the shadow rays visited.
+    long shadowNodes = 0;
+
+    void add(const RayCounters &counters);
+};
+
+// The rays after the primary ones in the wavefront mode, and the time spent on ordering and tracing them.
+struct WavefrontTimes {
+    long secondaryRays = 0;
+    double sortTime = 0;
+    double traceTime = 0;
+};
+
+/* trace() of fragmentQuad.shader on the CPU: ambient light, Lambert and Blinn-Phong shading of the light behind a shadow
+ * ray, and mirror reflections weighted by the Schlick approximation up to depth 5. It reads the same flat tree, triangle
+ * records and materials the shader storage buffers hold, so it renders the image of the window without a GL context.
+ */
+class CpuTracer {
+private:
+    const vector<FlatBvhNode> &nodes;
+    const vector<TriangleRecord> &leafRecords;
+    const vector<unsigned int> &leafMaterials;
+    const vector<Material> &materials;
+    Light light;
+    // texture1 of the shader, RGB texels with the bottom row first, as GL stores the flipped image.
+    vector<unsigned char> texture;
+    int textureWidth;
+    int textureHeight;
+    // The primary rays are traced in packets of this many rays, 0 traces them one by one.
+    int packetWidth;
+    // The leaves of the rays traced one by one are tested in blocks of triangles, the width is 0 without them.
+    TriangleBlocks triangleBlocks;
+
+    // The closest hit through the stackless traversal of the binary tree, t is -1 if the ray hits nothing.
+    CpuHit traverseBvhTree(const Ray &ray) const;
+
+    // The closest hit of one ray, with the leaves tested in blocks when there are blocks.
+    void traceSingle(const Ray &ray, float &closestT, int &triangle) const;
+
+    // Whether the shadow ray hits any triangle, it stops at the first one. Counted in 'counters'.
+    bool isOccluded(const Ray &shadowRay, RayCounters &counters) const;
+
+    // The same query without the counters, the nodes it visited are added to 'visitedNodes'.
+    bool isOccluded(const Ray &shadowRay, long &visitedNodes) const;
+
+    // The hit of the ray at the given distance on the given triangle of the leaf order, or no hit for triangle -1.
+    CpuHit getHit(const Ray &ray, float t, int triangle) const;
+
+    // Bilinear filtering with repeated texture coordinates, like the sampler of the shader.
+    glm::vec3 sampleTexture(float u, float v) const;
+
+    /* Traces the primary rays of the image in 16x16 pixel tiles on 'threadCount' threads, the threads take the next
+     * tile until none is left. The rays of a tile are traced in packets of neighbouring pixels, and 'shade' is called
+     * with the pixel index, the ray and its closest hit. Returns the sum of the rays 'shade' counted.
+     */
+    RayCounters tracePrimaryRays(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                                 const glm::vec3 &canvasY, int width, int height, int threadCount,
+                                 const function<void(int, const Ray &, const CpuHit &, RayCounters &)> &shade) const;
+
+    // The order of the rays by their direction octant first, then by the Morton code of their origin in the scene box.
+    vector<int> getRayOrder(const vector<Ray> &rays, int threadCount) const;
+
+public:
+    // The leaves are tested in blocks of 'blockWidth' triangles, e.g. TriangleBlocks::chooseWidth(), 0 tests them one
+    // by one.
+    CpuTracer(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+              const vector<unsigned int> &leafMaterials, const vector<Material> &materials, const Light &light,
+              int blockWidth);
+
+    bool loadTexture(const string &path);
+
+    // RayPacket::getWidth() by default, 0 turns the packets off.
+    void setPacketWidth(int packetWidth);
+
+    // The colour of one ray. The ray, its reflections and shadow rays are added to 'counters'.
+    glm::vec3 trace(const Ray &ray, RayCounters &counters) const;
+
+    // The same, with the closest hit of the ray already found.
+    glm::vec3 trace(Ray ray, CpuHit hit, RayCounters &counters) const;
+
+    // The ray of pixel (x, y) from the bottom left, as the vertex shader sets it up for the pixel.
+    static Ray getPrimaryRay(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                             const glm::vec3 &canvasY, int x, int y, int width, int height);
+
+    /* Renders the image in 16x16 pixel tiles on 'threadCount' threads, the threads take the next tile until none is
+     * left. The primary rays of a tile are traced in packets of neighbouring pixels, their reflections and shadow rays
+     * one by one. The image starts with the bottom row like the framebuffer. Returns the traced rays.
+     */
+    RayCounters render(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                       const glm::vec3 &canvasY, int width, int height, int threadCount,
+                       vector<glm::vec3> &image) const;
+
+    /* The same image bounce by bounce: the hits of all paths are shaded, then the shadow rays of the bounce are traced
+     * as one stream and the reflected rays as another. With 'sortRays' the streams are traced in the order of
+     * getRayOrder(), so the rays of a batch start close to each other in the same direction and walk the same nodes.
+     * The chunks of a stream are taken by the threads like the tiles.
+     */
+    RayCounters renderWavefront(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                                const glm::vec3 &canvasY, int width, int height, int threadCount, bool sortRays,
+                                vector<glm::vec3> &image, WavefrontTimes &times) const;
+
+    // Binary PPM with the top row first, the colours are clamped to [0, 1] like the framebuffer does it.
+    static bool writePpm(const string &path, int width, int height, const vector<glm::vec3> &image);
+};
+
+#endif //RAYTRACERBOROS_CPUTRACER_H
@@ -1,31 +1,144 @@
 #ifndef RAYTRACERBOROS_FLATBVHNODE_H
 #define RAYTRACERBOROS_FLATBVHNODE_H
 
-#include <array>
 #include <vector>
 #include "glm/glm.hpp"
 #include "bvhnode.h"
+#include "trianglerecord.h"
 
 using namespace std;
 
+/* Node of the tree in the shader storage buffer. The nodes are stored in depth-first pre-order, so the first child of
+ * an inner node is the next node. Every node links to the node to continue with when the ray hits its box (the first
+ * child, or the escape node for a leaf after its triangles are tested) and when it misses it (the next node that is not
+ * in its subtree, -1 at the end of the tree). Both the shader and the CPU walk the tree in one loop without a stack.
+ */
 class FlatBvhNode {
     glm::vec4 min;
     glm::vec4 max;
     int order;
     int isLeaf;
-    int createdEmpty;
-    int leftOrRight;
-    array<glm::vec4, 10> indices;
+    int hitLink;
+    int missLink;
+    // Range of the leaf in the triangle buffer, the shader reads the triangles from there.
+    int firstIndex;
+    int indexCount;
+    // Keeps the size a multiple of 16 bytes, as the std430 array of the shader expects.
+    int padding[2];
 
 public:
     FlatBvhNode()=default;
 
-    FlatBvhNode(glm::vec3 min, glm::vec3 max, float ind, bool isLeaf, bool createdEmpty,
-                vector<glm::vec4> indices, int leftOrRight);
+    FlatBvhNode(glm::vec3 min, glm::vec3 max, float ind, bool isLeaf, int missLink, int firstIndex, int indexCount);
 
-    static FlatBvhNode nodeConverter( BvhNode node, int ind);
+    static FlatBvhNode nodeConverter(const BvhNode &node, int ind, int missLink);
 
-    static vector<FlatBvhNode> *putNodeIntoArray( BvhNode * node);
+    static vector<FlatBvhNode> putNodeIntoArray(const BvhNode &root);
+
+    // The stackless traversal of the shader on the CPU, it counts the visited nodes and the tested triangles of one ray.
+    // The triangles are read through the vertex indices of the leaves.
+    static void traceForStatistics(const vector<FlatBvhNode> &nodes, const vector<glm::uvec3> &leafTriangles,
+                                   const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles);
+
+    // The same traversal with the precomputed triangle records of the leaves, as the shader does it. The traversal
+    // starts at 'rootNode', the root of a bottom-level tree in the node buffer of several trees.
+    static void traceForStatistics(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                                   const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles,
+                                   int rootNode = 0);
+
+    // The traversal loop, 'intersectTriangle(j)' tests the j-th triangle of the leaf order (or whatever the leaves of
+    // the tree point to) and returns the distance of the hit or -1.
+    template<typename TriangleTest>
+    static void traverse(const vector<FlatBvhNode> &nodes, const Ray &ray, float &closestT, int &visitedNodes,
+                         int &testedTriangles, const TriangleTest &intersectTriangle, int rootNode = 0);
+
+    // The occlusion query of the same loop: it returns true at the first triangle hit closer than maxT, without looking
+    // for the closest one.
+    template<typename TriangleTest>
+    static bool traverseAnyHit(const vector<FlatBvhNode> &nodes, const Ray &ray, float maxT, int &visitedNodes,
+                               int &testedTriangles, const TriangleTest &intersectTriangle, int rootNode = 0);
+
+    /* Recomputes the bounds bottom-up after the vertices moved, the topology stays. Disjoint subtrees are refitted on
+     * 'taskCount' threads, then the nodes above them. changedNodes[i] is set if the box of node i changed.
+     */
+    static void refit(vector<FlatBvhNode> &nodes, const vector<glm::uvec3> &leafTriangles,
+                      const vector<glm::vec4> &coordinates, int taskCount, vector<char> &changedNodes);
+
+    // The [begin, end) ranges of the changed nodes. Ranges closer than 'mergeGap' nodes are merged into one upload.
+    static vector<pair<int, int>> getDirtyRanges(const vector<char> &changedNodes, int mergeGap);
+
+    // SAH cost of the flat tree, as BvhNode::getSahCost computes it for the pointer tree.
+    static float getSahCost(const vector<FlatBvhNode> &nodes, const BvhSettings &settings);
+
+    glm::vec3 getMin() const;
+
+    glm::vec3 getMax() const;
+
+    int getHitLink() const;
+
+    int getMissLink() const;
+
+    int getFirstIndex() const;
+
+    int getIndexCount() const;
+
+private:
+    // The first node after the subtree of node i in the pre-order.
+    static int getSubtreeEnd(const vector<FlatBvhNode> &nodes, int i);
+
+    static bool refitNode(vector<FlatBvhNode> &nodes, int i, const vector<glm::uvec3> &leafTriangles,
+                          const vector<glm::vec4> &coordinates);
 };
 
+template<typename TriangleTest>
+void FlatBvhNode::traverse(const vector<FlatBvhNode> &nodes, const Ray &ray, float &closestT, int &visitedNodes,
+                           int &testedTriangles, const TriangleTest &intersectTriangle, int rootNode) {
+    int i = rootNode;
+    while (i != -1) {
+        const FlatBvhNode &node = nodes[i];
+        visitedNodes++;
+
+        float entryT;
+        if (!rayIntersectWithBox(glm::vec3(node.min), glm::vec3(node.max), ray, closestT, entryT)) {
+            i = node.missLink;
+            continue;
+        }
+
+        for (int j = node.firstIndex; j < node.firstIndex + node.indexCount; j++) {
+            testedTriangles++;
+            float t = intersectTriangle(j);
+            if (t > 0 && t < closestT) {
+                closestT = t;
+            }
+        }
+        i = node.hitLink;
+    }
+}
+
+template<typename TriangleTest>
+bool FlatBvhNode::traverseAnyHit(const vector<FlatBvhNode> &nodes, const Ray &ray, float maxT, int &visitedNodes,
+                                 int &testedTriangles, const TriangleTest &intersectTriangle, int rootNode) {
+    int i = rootNode;
+    while (i != -1) {
+        const FlatBvhNode &node = nodes[i];
+        visitedNodes++;
+
+        float entryT;
+        if (!rayIntersectWithBox(glm::vec3(node.min), glm::vec3(node.max), ray, maxT, entryT)) {
+            i = node.missLink;
+            continue;
+        }
+
+        for (int j = node.firstIndex; j < node.firstIndex + node.indexCount; j++) {
+            testedTriangles++;
+            float t = intersectTriangle(j);
+            if (t > 0 && t < maxT) {
+                return true;
+            }
+        }
+        i = node.hitLink;
+    }
+    return false;
+}
+
 #endif //RAYTRACERBOROS_FLATBVHNODE_H
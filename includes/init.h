@@ -4,6 +4,7 @@
 #ifndef RAYTRACERBOROS_INIT_H
 #define RAYTRACERBOROS_INIT_H
 
+#include <chrono>
 #include "shaderprogram.h"
 #include <GLFW/glfw3.h>
 #include "glm/glm.hpp"
@@ -13,9 +14,16 @@
 #include "filesystem.h"
 #include "bvhnode.h"
 #include "flatbvhnode.h"
+#include "widebvh.h"
+#include "compressedbvh.h"
+#include "toplevelbvh.h"
+#include "bvhcache.h"
+#include "bvhstatistics.h"
 #include "stb_image.h"
 #include "light.h"
 #include "camera.h"
+#include "settings.h"
+#include "allocationcounter.h"
 
 vector<glm::vec4> hiddenPrimitives;
 const vector<glm::vec4> &BBox::primitiveCoordinates(hiddenPrimitives);
@@ -30,6 +38,9 @@ class Init {
 
 private:
     const pair<const float, const float> SCR_W_H;
+    const Settings settings;
+    // The layout the shader traverses, the BVH4 replaces the compressed one if the tree does not fit in its nodes.
+    BvhLayout bvhLayout;
     Camera camera;
     Light light;
     GLuint quadVAO;
@@ -40,9 +51,37 @@ private:
     Shader shaderQuadFragment;
 
     Model mymodel;
+    BvhNodeArena nodeArena;
     BvhNode *bvhNode;
     GLFWwindow *window;
 
+    // The flat tree and the triangles of the leaves stay on the CPU, so the animated model can be refitted.
+    vector<FlatBvhNode> flatNodes;
+    vector<TriangleRecord> leafRecords;
+    vector<glm::vec4> restPositions;
+    // The triangles without the duplicates of the split BVH, the rebuilds of the animation start from them.
+    vector<glm::uvec3> restTriangles;
+    vector<unsigned int> restTriangleMaterials;
+    float builtSahCost;
+    unsigned int nodesArraytoSendtoShader;
+    unsigned int leafRecordsToSendToShader;
+    unsigned int leafMaterialsToSendToShader;
+    // The copies of the model: the bottom-level tree is the flat tree above, these are the transforms and the tree
+    // over them.
+    vector<glm::vec3> instancePositions;
+    glm::vec3 instanceCenter;
+    vector<Instance> instances;
+    vector<FlatBvhNode> topNodes;
+    unsigned int instancesToSendToShader;
+    unsigned int topNodesToSendToShader;
+    chrono::duration<double, milli> refitTime;
+    long refitUploadedNodes;
+    long refitUploadedRecords;
+    int refitFrames;
+    // The shadow ray counters of the shader, and the frames they were added up in.
+    unsigned int shadowCountersToSendToShader;
+    int shadowCounterFrames;
+
     glm::vec3 connect;
     glm::vec3 canvasX;
     glm::vec3 canvasY;
@@ -54,8 +93,57 @@ private:
 
     void sendVerticesIndices();
 
+    void loadScene();
+
+    // Reads the model and its tree from the cache file, false if the file is missing or out of date.
+    bool loadBvhTreeFromCache(const string &cachePath, uint64_t cacheKey);
+
+    void saveBvhTreeToCache(const string &cachePath, uint64_t cacheKey);
+
     void buildBvhTree();
 
+    void uploadTreeBuffers();
+
+    // Moves the vertices of the model for the given time and refits the tree to them.
+    void animateModel(float time);
+
+    // Recomputes the boxes of the tree for the moved vertices and uploads the changed nodes, or rebuilds the tree
+    // when the refitted one got too expensive.
+    void refitBvhTree();
+
+    void rebuildBvhTree();
+
+    void placeInstances();
+
+    void moveInstances(float time);
+
+    // Reads back the shadow ray counters of the shader every 100 frames, prints them and sets them to zero.
+    void readShadowCounters();
+
+    // To the console, or to the statistics file of the settings.
+    void printStatistics(const BvhStatistics &statistics);
+
+    void compareBuilders();
+
+    // Traces a grid of primary rays through the tree on the CPU and averages the visited nodes and tested triangles.
+    void measureTraversal(const BvhNode *tree, const vector<int> &triangleIndices, float &nodesPerRay,
+                          float &trianglesPerRay);
+
+    // The same measurement with the stackless traversal of the flat tree that the shader runs.
+    void measureFlatTraversal(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                              float &nodesPerRay, float &trianglesPerRay);
+
+    // Triangle tests per second of the flat traversal with and without the precomputed triangle records.
+    void benchmarkTriangleTests(const vector<FlatBvhNode> &nodes, const vector<glm::uvec3> &leafTriangles,
+                                const vector<TriangleRecord> &leafRecords);
+
+    // Node fetches per ray and traced rays per second of the binary, the BVH4, the BVH8 and the compressed layout.
+    void compareLayouts(const vector<FlatBvhNode> &binaryNodes, const vector<WideBvhNode<4>> &wideNodes4,
+                        const vector<WideBvhNode<8>> &wideNodes8, const vector<CompressedBvhNode> &compressedNodes,
+                        const vector<TriangleRecord> &leafRecords);
+
+    Ray getPrimaryRay(int x, int y, int columns, int rows);
+
     // The rotation around Y-axis works fine without any ratio distortion
     void rotateCamAroundY(float param);
 
@@ -68,7 +156,7 @@ private:
 
 public:
 
-    Init();
+    Init(const Settings &settings);
 
     int setup();
 
@@ -0,0 +1,45 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_LBVH_H
+#define RAYTRACERBOROS_LBVH_H
+
+#include <cstdint>
+#include <vector>
+#include "buildprimitives.h"
+
+using namespace std;
+
+// Internal node of the linear BVH, it covers the [first, last] range of the sorted triangles and is split after 'split'.
+struct LbvhNode {
+    int first;
+    int last;
+    int split;
+};
+
+/* Linear BVH construction (Karras 2012): the triangles are sorted along the Morton curve of their centroids, and the
+ * n-1 internal nodes of the binary radix tree over the sorted codes are emitted independently of each other.
+ * Every step is linear in the number of triangles and runs on several threads.
+ */
+class Lbvh {
+public:
+    // Sorts primitives.triangleOrder by the 30 or 63 bit Morton code of the centroids and returns the sorted codes.
+    static vector<uint64_t> sortByMortonCode(BuildPrimitives &primitives, int mortonBits, int taskCount);
+
+    // Internal node i of the radix tree, the root is node 0.
+    static vector<LbvhNode> emitHierarchy(const vector<uint64_t> &sortedCodes, int taskCount);
+
+    // The lowest 21 bits of the value with two zero bits inserted between them, for 63 bit Morton codes.
+    static uint64_t expandBits(uint64_t value);
+
+    // Stable sort of the lowest 'bits' bits of the keys, the values move with their keys.
+    static void radixSort(vector<uint64_t> &keys, vector<int> &values, int bits, int taskCount);
+
+private:
+    static int commonPrefix(const vector<uint64_t> &codes, int i, int j);
+
+    static void emitRange(const vector<uint64_t> &codes, vector<LbvhNode> &nodes, int begin, int end);
+};
+
+#endif //RAYTRACERBOROS_LBVH_H
@@ -11,7 +11,14 @@
 #ifndef MESH_H
 #define MESH_H
 
+#ifdef HEADLESS
+// The headless renderer has no GL context: the GL types are plain integers, the meshes are neither uploaded nor drawn.
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef unsigned char GLboolean;
+#else
 #include <GL/glew.h>
+#endif
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -21,7 +28,9 @@
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#ifndef HEADLESS
 #include "shaderprogram.h"
+#endif
 
 using namespace std;
 
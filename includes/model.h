@@ -25,7 +25,9 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "mesh.h"
+#ifndef HEADLESS
 #include "shaderprogram.h"
+#endif
 
 
 
@@ -43,7 +45,9 @@ public:
 
     vector<Mesh> meshes;
     vector<glm::vec4> allPositionVertices;
-    vector<glm::vec4> indicesInModel;
+    // The vertex indices of the triangles and, separately, the material of each triangle.
+    vector<glm::uvec3> indicesInModel;
+    vector<unsigned int> materialIndicesInModel;
     vector<Material> materials;
     vector<Texture> textures_loaded;    // Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 
@@ -58,6 +62,16 @@ public:
 
     void getInfoAboutModel();
 
+    // Puts the triangles into the order of the BVH leaves, a triangle listed by several leaves is duplicated.
+    void reorderTriangles(const vector<int> &triangleOrder);
+
+    // The triangles and their materials with every duplicate of reorderTriangles() left out, in the order of their
+    // first copy.
+    void getUniqueTriangles(vector<glm::uvec3> &triangles, vector<unsigned int> &triangleMaterials) const;
+
+    // Renumbers the vertices in the order the triangles first use them, so the vertices of a leaf are stored together.
+    void reorderVertices();
+
 private:
 
     // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
@@ -0,0 +1,22 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_RAY_H
+#define RAYTRACERBOROS_RAY_H
+
+#include "glm/glm.hpp"
+
+// CPU side counterparts of the ray tests in fragmentQuad.shader.
+struct Ray {
+    glm::vec3 orig;
+    glm::vec3 dir;
+};
+
+// Slab test of the box against the [0, maxT] interval of the ray. On a hit entryT is the distance where the ray enters.
+bool rayIntersectWithBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const Ray &ray, float maxT, float &entryT);
+
+// Möller-Trumbore intersection, returns the distance of the hit or -1 if the triangle is missed.
+float rayTriangleIntersect(const Ray &ray, const glm::vec3 &pointA, const glm::vec3 &pointB, const glm::vec3 &pointC);
+
+#endif //RAYTRACERBOROS_RAY_H
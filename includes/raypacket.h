@@ -0,0 +1,68 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_RAYPACKET_H
+#define RAYTRACERBOROS_RAYPACKET_H
+
+#include <vector>
+#include "flatbvhnode.h"
+#include "trianglerecord.h"
+#include "ray.h"
+
+using namespace std;
+
+// Counters of the packet traversal, summed over the traced packets.
+struct PacketCounters {
+    long packets = 0;
+    // Nodes a packet was tested against, and the active rays of those tests summed up.
+    long nodeTests = 0;
+    long activeRays = 0;
+    // Rays finished one by one after their packet became incoherent.
+    long fallbackRays = 0;
+    // Occlusion queries: the rays that stopped at their first hit, and the nodes the rays finished alone visited.
+    long occludedRays = 0;
+    long fallbackNodes = 0;
+};
+
+/* Traversal of 8 (AVX2) or 16 (AVX-512) rays at once through the flat binary tree, for coherent rays like the primary
+ * rays of neighbouring pixels. Every ray keeps the node it continues with: a ray that misses a node waits at its miss
+ * link. The links of the depth-first order point forward, so the packet always visits the lowest of these nodes and
+ * every ray meets the nodes of its own stackless traversal, with the rays waiting elsewhere masked out. When less than a
+ * quarter of the rays of the packet are active at a node, the rays finish one by one from their own node.
+ * The kernels are compiled for both instruction sets and chosen at run time, the CPU does not need to support them.
+ */
+class RayPacket {
+public:
+    // 16 if the CPU has AVX-512, 8 with AVX2, 0 without them: then the rays are traced one by one.
+    static int getWidth();
+
+    // The block of pixels one packet of the width covers, 4x2 or 4x4.
+    static void getShape(int width, int &columns, int &rows);
+
+    /* Closest hits of 'count' rays, at most getWidth() of them, or one by one if it is 0. closestT[r] and triangles[r]
+     * are the distance and the leaf order index of the closest triangle of ray r, triangles[r] is -1 if it hits nothing.
+     */
+    static void trace(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords, const Ray *rays,
+                      int count, float *closestT, int *triangles, PacketCounters &counters);
+
+    // The same with packets of the given width, for comparing the widths. It must be supported by the CPU.
+    static void trace(int width, const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                      const Ray *rays, int count, float *closestT, int *triangles, PacketCounters &counters);
+
+    /* Occlusion queries of shadow rays in packets of the given width, or one by one if it is 0. occluded[r] is set if
+     * ray r hits any triangle: a ray stops at the first one, and the packet ends when all of its rays stopped.
+     */
+    static void traceOcclusion(int width, const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                               const Ray *rays, int count, bool *occluded, PacketCounters &counters);
+
+    // The stackless traversal of one ray from 'rootNode' on, it lowers closestT and notes the triangle of the hits.
+    static void traceSingle(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                            const Ray &ray, int rootNode, float &closestT, int &triangle);
+
+    // The occlusion query of one ray from 'rootNode' on, it adds the nodes it visited to 'visitedNodes'.
+    static bool isOccluded(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords, const Ray &ray,
+                           int rootNode, long &visitedNodes);
+};
+
+#endif //RAYTRACERBOROS_RAYPACKET_H
@@ -0,0 +1,128 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_SETTINGS_H
+#define RAYTRACERBOROS_SETTINGS_H
+
+#include <string>
+
+using namespace std;
+
+enum class SplitMethod {
+    CentroidMidpoint,   // Cutting the longest axis at the average centroid of the triangles.
+    BinnedSah           // Surface area heuristic evaluated on centroid bins along all three axes.
+};
+
+enum class BuilderType {
+    TopDown,            // Recursive splitting of the triangles with the split method.
+    Linear,             // Linear BVH emitted over the Morton order of the centroids, for fast builds of large meshes.
+    Spatial             // Split BVH: object splits and spatial splits that clip the triangles into both children.
+};
+
+// Layouts of the flattened tree. The shader selects its traversal by the value, for the uncompressed layouts it is the
+// number of children of a node.
+enum class BvhLayout {
+    Compressed4 = 1,    // CompressedBvhNode: the BVH4 with 8 bit child bounds in a 64 byte node.
+    Binary = 2,         // FlatBvhNode: depth-first binary nodes with hit and miss links, stackless traversal.
+    Wide4 = 4,          // WideBvhNode<4>: four children, their bounds are stored per axis for one 4-wide box test.
+    Wide8 = 8           // WideBvhNode<8>: eight children, tested as two groups of four.
+};
+
+// Format of the tree statistics printed after the build.
+enum class StatisticsFormat {
+    Text,               // Labelled lines and histograms for reading.
+    Json                // One JSON object, for comparing the runs of builders with scripts.
+};
+
+struct BvhSettings {
+    BuilderType builderType = BuilderType::TopDown;
+    SplitMethod splitMethod = SplitMethod::CentroidMidpoint;
+    int sahBins = 16;
+    // A node becomes a leaf when it has at most maxLeafSize triangles or it is at maxDepth.
+    int maxLeafSize = 4;
+    int maxDepth = 32;
+    float traversalCost = 1.0f;
+    float intersectionCost = 1.0f;
+    int buildThreads = 1;
+    // Nodes with at least this many triangles hand one child over to another thread.
+    int parallelBuildCutoff = 4096;
+    // 30 or 63 bit Morton codes for the linear builder.
+    int mortonBits = 63;
+    // The split BVH may add at most this fraction of the triangle count as extra references.
+    float spatialSplitBudget = 0.3f;
+    // Spatial splits are tried when the overlap of the object split children exceeds this fraction of the root surface.
+    float spatialSplitAlpha = 1e-5f;
+    // Builds the tree with every builder at startup and prints their build time and SAH cost.
+    bool compareBuilders = false;
+    // After the build small treelets are restructured into their SAH-optimal topology, in at most treeletPasses
+    // passes over the tree and in at most treeletTimeBudget milliseconds.
+    bool optimizeTreelets = false;
+    int treeletLeaves = 7;
+    int treeletPasses = 3;
+    float treeletTimeBudget = 1000.0f;
+    // A refitted tree is rebuilt when its SAH cost exceeds this multiple of the cost right after the build.
+    float refitRebuildThreshold = 1.5f;
+    // The binary tree is collapsed into a wide tree for the shader if the layout is not binary.
+    BvhLayout layout = BvhLayout::Binary;
+    // Traces the primary rays through every layout on the CPU and prints their node fetches and speed.
+    bool compareLayouts = false;
+    // Traces the primary rays through the flat tree on the CPU, with the triangles read through their vertex indices
+    // and as precomputed records, and prints the triangle tests per second of both.
+    bool benchmarkTriangleTests = false;
+
+    const char *getSplitMethodName() const;
+
+    string getBuilderName() const;
+
+    static const char *getLayoutName(BvhLayout layout);
+};
+
+struct Settings {
+    string modelPath = "../model/CornellBox-Original.obj";
+    BvhSettings bvh;
+    // After the build the vertices are renumbered in the order of the BVH leaves, like the triangles.
+    bool reorderVertices = true;
+    // The vertices are moved every frame and the tree is refitted to them.
+    bool animate = false;
+    // Copies of the model placed on a grid, each one a transform of the same bottom-level tree. 0 traces the model
+    // without the top-level tree.
+    int instanceCount = 0;
+    // The built scene is stored in a cache file next to the model and loaded from there when the model and the
+    // builder settings are the same.
+    bool useBvhCache = true;
+    // The statistics of the built tree go to the console, or into statisticsPath if it is set.
+    StatisticsFormat statisticsFormat = StatisticsFormat::Text;
+    string statisticsPath;
+    // The headless renderer traces an image of this size on renderThreads threads and writes it into imagePath.
+    int imageWidth = 1280;
+    int imageHeight = 720;
+    int renderThreads = 1;
+    string imagePath = "render.ppm";
+    // The headless renderer traces the primary rays in SIMD packets when the CPU has AVX2 or AVX-512.
+    bool usePacketTraversal = true;
+    // Before rendering the primary rays are traced one by one and in packets of every supported width, and their
+    // speed is compared.
+    bool benchmarkPackets = false;
+    // The rays traced one by one test the triangles of a leaf in SIMD blocks of 4, 8 or 16 triangles, in trees with
+    // more than 4 triangles in a leaf.
+    bool useTriangleBlocks = true;
+    // Before rendering rays are tested against the triangles of the leaves one by one and in blocks of every supported
+    // width, in the tree and against all triangles of the model, and their speed is compared.
+    bool benchmarkTriangleBlocks = false;
+    // The headless renderer traces the image bounce by bounce, the shadow and reflected rays of a bounce as one stream.
+    bool wavefront = false;
+    // The streams of the wavefront mode are ordered by direction and origin before they are traced.
+    bool sortRays = true;
+    // The shader counts its shadow rays and the occluded ones, the window prints them every 100 frames.
+    bool countShadowRays = false;
+
+    // Reads the startup options, e.g.: --model=../model/bunny.obj --split=sah --bins=32 --threads=16 --builder=lbvh
+    // --leaf-size=4 --max-depth=32 --treelets --treelet-leaves=7 --instances=100
+    // --stats=json --stats-file=stats.json --width=1920 --height=1080 --render-threads=16 --output=bunny.ppm
+    // --no-packets --benchmark-packets --no-triangle-blocks --benchmark-triangle-blocks --wavefront --no-ray-sorting
+    // --shadow-stats --benchmark-triangle-tests
+    static Settings fromArguments(int argc, char **argv);
+};
+
+#endif //RAYTRACERBOROS_SETTINGS_H
@@ -0,0 +1,91 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_SPLITBVHBUILDER_H
+#define RAYTRACERBOROS_SPLITBVHBUILDER_H
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "buildprimitives.h"
+#include "settings.h"
+#include "bvhnodearena.h"
+
+using namespace std;
+
+class BvhNode;
+
+// A triangle in a node of the split BVH. Spatial splits clip the bounds, so one triangle can have several references.
+struct SbvhReference {
+    int triangle;
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+/* Split BVH builder (Stich et al. 2009). Besides the binned SAH object split it evaluates spatial splits that cut
+ * the node into slabs and clip the straddling triangles into both children. Spatial splits are only tried when the
+ * children of the best object split overlap, and they can add at most settings.spatialSplitBudget * n references.
+ */
+class SplitBvhBuilder {
+private:
+    struct ObjectSplit {
+        float cost;
+        int axis;
+        int plane;
+        float centerMin;
+        float scale;
+        glm::vec3 leftMin, leftMax;
+        glm::vec3 rightMin, rightMax;
+    };
+
+    struct SpatialSplit {
+        float cost;
+        int axis;
+        float position;
+        int duplicates;
+    };
+
+    const BuildPrimitives &primitives;
+    const vector<glm::vec4> &coordinates;
+    const BvhSettings &settings;
+    BvhNodeArena &arena;
+    float rootArea;
+    int referenceBudget;
+    int numberOfReferences;
+    int numberOfSpatialSplits;
+    vector<int> triangleIndices;
+
+    void buildNode(BvhNode *node, vector<SbvhReference> &references, int depth);
+
+    void makeLeaf(BvhNode *node, const vector<SbvhReference> &references);
+
+    ObjectSplit findObjectSplit(const vector<SbvhReference> &references, float parentArea);
+
+    SpatialSplit findSpatialSplit(const vector<SbvhReference> &references, const glm::vec3 &nodeMin,
+                                  const glm::vec3 &nodeMax, float parentArea);
+
+    void performObjectSplit(const vector<SbvhReference> &references, const ObjectSplit &split,
+                            vector<SbvhReference> &left, vector<SbvhReference> &right);
+
+    void performSpatialSplit(const vector<SbvhReference> &references, const SpatialSplit &split,
+                             vector<SbvhReference> &left, vector<SbvhReference> &right);
+
+    // Bounds of the part of the triangle between the 'low' and 'high' planes on the axis, limited to the reference.
+    bool clipReference(const SbvhReference &reference, int axis, float low, float high, glm::vec3 &clippedMin,
+                       glm::vec3 &clippedMax) const;
+
+public:
+    SplitBvhBuilder(const BuildPrimitives &primitives, const vector<glm::vec4> &coordinates,
+                    const BvhSettings &settings, BvhNodeArena &arena);
+
+    void build(BvhNode *root);
+
+    // The triangles of the leaves, every leaf covers a contiguous range of it.
+    vector<int> &getTriangleIndices();
+
+    int getNumberOfReferences() const;
+
+    int getNumberOfSpatialSplits() const;
+};
+
+#endif //RAYTRACERBOROS_SPLITBVHBUILDER_H
@@ -0,0 +1,50 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_TOPLEVELBVH_H
+#define RAYTRACERBOROS_TOPLEVELBVH_H
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "flatbvhnode.h"
+#include "trianglerecord.h"
+
+using namespace std;
+
+// A copy of a bottom-level tree placed in the scene, 144 bytes as the std430 array of the shader expects.
+struct Instance {
+    glm::mat4 worldToObject;
+    glm::mat4 objectToWorld;
+    // The root of the bottom-level tree in the node buffer.
+    int rootNode;
+    int padding[3];
+};
+
+/* Top level of the two-level structure: a tree over the world space boxes of the instances, in the same flat layout as
+ * the bottom-level trees. Its leaves point into the instance list, which is put into the order of the leaves. At an
+ * instance the ray is transformed into object space without normalizing its direction, so the distances of the hits
+ * are the same in both spaces. Moving an instance only needs this tree to be rebuilt.
+ */
+class TopLevelBvh {
+private:
+    static void buildNode(BvhNode *node, vector<int> &instanceOrder, int begin, int end,
+                          const vector<glm::vec3> &boxMin, const vector<glm::vec3> &boxMax, int depth,
+                          BvhNodeArena &arena);
+
+public:
+    // World space bounds of the box of the bottom-level tree the instance places.
+    static void getWorldBounds(const Instance &instance, const vector<FlatBvhNode> &bottomNodes, glm::vec3 &worldMin,
+                               glm::vec3 &worldMax);
+
+    static Instance makeInstance(const glm::mat4 &objectToWorld, int rootNode);
+
+    static vector<FlatBvhNode> build(vector<Instance> &instances, const vector<FlatBvhNode> &bottomNodes);
+
+    // Closest-hit traversal of both levels on the CPU, it counts the visited nodes of both and the tested triangles.
+    static void traceForStatistics(const vector<FlatBvhNode> &topNodes, const vector<Instance> &instances,
+                                   const vector<FlatBvhNode> &bottomNodes, const vector<TriangleRecord> &leafRecords,
+                                   const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles);
+};
+
+#endif //RAYTRACERBOROS_TOPLEVELBVH_H
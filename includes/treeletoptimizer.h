@@ -0,0 +1,72 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_TREELETOPTIMIZER_H
+#define RAYTRACERBOROS_TREELETOPTIMIZER_H
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "glm/glm.hpp"
+#include "settings.h"
+
+using namespace std;
+
+class BvhNode;
+
+/* Treelet restructuring (Karras and Aila 2013) of a built tree. Bottom-up, every inner node is the root of a treelet:
+ * its inner descendant with the largest surface is opened until the treelet has settings.treeletLeaves leaves. The
+ * SAH-optimal binary tree over those leaves is found with dynamic programming over the subsets of the leaves, and if
+ * it is cheaper the treelet is rebuilt with the same nodes. Subtrees of the top levels are optimized on their own
+ * threads. The leaves themselves are kept, so the leaf size and the triangle references do not change.
+ */
+class TreeletOptimizer {
+private:
+    static const int maxTreeletLeaves = 10;
+
+    // The leaves and inner nodes of one treelet and the tables of the dynamic programming, indexed by leaf subsets.
+    struct Treelet {
+        int leafCount;
+        int innerNodeCount;
+        BvhNode *leaves[maxTreeletLeaves];
+        BvhNode *innerNodes[maxTreeletLeaves];
+        float costs[1 << maxTreeletLeaves];
+        int partitions[1 << maxTreeletLeaves];
+        glm::vec3 boundsMin[1 << maxTreeletLeaves];
+        glm::vec3 boundsMax[1 << maxTreeletLeaves];
+    };
+
+    const BvhSettings &settings;
+    // The SAH cost of every subtree (not divided by the root surface), indexed by the order of the node.
+    vector<float> subtreeCosts;
+    chrono::steady_clock::time_point deadline;
+    atomic<bool> timedOut;
+    atomic<int> restructuredTreelets;
+    int spawnDepth;
+
+    void optimizeSubtree(BvhNode *node, int depth);
+
+    void restructureTreelet(BvhNode *root);
+
+    void findOptimalPartitions(Treelet &treelet);
+
+    // Links the subtree of the optimal partition of 'subset' below 'target', or below the next unused inner node.
+    BvhNode *rebuildTreelet(const Treelet &treelet, int subset, BvhNode *target, int &nextInnerNode);
+
+    // Depth, side and leaf ranges after the restructuring: the triangle index list is put into the new leaf order.
+    void renumber(BvhNode *node, int depth, int leftOrRight, const vector<int> &triangleIndices,
+                  vector<int> &reorderedIndices);
+
+public:
+    explicit TreeletOptimizer(const BvhSettings &settings);
+
+    // Optimizes the tree that 'triangleIndices' belongs to, the node orders have to be assigned.
+    void optimize(BvhNode *root, vector<int> &triangleIndices);
+
+    int getRestructuredTreelets() const;
+
+    bool getTimedOut() const;
+};
+
+#endif //RAYTRACERBOROS_TREELETOPTIMIZER_H
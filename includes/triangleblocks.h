@@ -0,0 +1,56 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_TRIANGLEBLOCKS_H
+#define RAYTRACERBOROS_TRIANGLEBLOCKS_H
+
+#include <vector>
+#include "flatbvhnode.h"
+#include "trianglerecord.h"
+#include "ray.h"
+
+using namespace std;
+
+/* The triangle records of the leaves regrouped into blocks of 4 (SSE), 8 (AVX2) or 16 (AVX-512) triangles, so one ray
+ * is tested against a whole block at once. A block keeps every coordinate of the records in an array of its own, one
+ * triangle per SIMD lane, and the last block of a leaf is padded with empty triangles that never hit. The kernels are
+ * compiled for the three instruction sets and chosen at run time like the ones of RayPacket.
+ */
+class TriangleBlocks {
+    int width;
+    // 9 * width floats per block: pointA, edgeAB and edgeAC, x, y and z of each.
+    vector<float> blocks;
+    // The first block of every node of the tree, -1 for the inner nodes.
+    vector<int> nodeBlocks;
+
+    // The triangles of a leaf block by block. With AnyHit it returns true at the first hit closer than closestT.
+    template<bool AnyHit>
+    bool intersectLeaf(const FlatBvhNode &node, int i, const Ray &ray, float &closestT, int &triangle) const;
+
+public:
+    // Without blocks, the leaves are tested triangle by triangle.
+    TriangleBlocks();
+
+    // The blocks of the given width for the leaves of the tree, it must be supported by the CPU.
+    TriangleBlocks(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords, int width);
+
+    // 16 if the CPU has AVX-512, 8 with AVX2, 4 otherwise.
+    static int getWidth();
+
+    // The narrowest supported width that holds the largest leaf of the tree in one block, or getWidth(). 0 for trees
+    // with at most 4 triangles in a leaf, there the triangles are faster tested one by one.
+    static int chooseWidth(const vector<FlatBvhNode> &nodes);
+
+    // The width of the blocks, 0 without them.
+    int getBlockWidth() const;
+
+    // The stackless traversal from 'rootNode' with the leaves tested block by block. It lowers closestT and notes the
+    // leaf order index of the triangle, the same one the tests one by one find.
+    void trace(const vector<FlatBvhNode> &nodes, const Ray &ray, int rootNode, float &closestT, int &triangle) const;
+
+    // The occlusion query of the same traversal, it stops at the first block with a hit and adds the visited nodes.
+    bool isOccluded(const vector<FlatBvhNode> &nodes, const Ray &ray, int rootNode, long &visitedNodes) const;
+};
+
+#endif //RAYTRACERBOROS_TRIANGLEBLOCKS_H
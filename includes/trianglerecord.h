@@ -0,0 +1,46 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_TRIANGLERECORD_H
+#define RAYTRACERBOROS_TRIANGLERECORD_H
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "ray.h"
+
+using namespace std;
+
+/* Everything the ray-triangle test needs, computed once on the CPU and stored in the order of the leaves, so the shader
+ * reads one contiguous 48 byte record per tested triangle instead of three vertices through the index buffer.
+ * The unit normal is kept in the w components, it is only read for the closest hit.
+ */
+struct TriangleRecord {
+    glm::vec4 pointA;   // xyz: first vertex,        w: normal.x
+    glm::vec4 edgeAB;   // xyz: second - first,      w: normal.y
+    glm::vec4 edgeAC;   // xyz: third - first,       w: normal.z
+
+    TriangleRecord() = default;
+
+    TriangleRecord(const glm::vec3 &pointA, const glm::vec3 &pointB, const glm::vec3 &pointC);
+
+    glm::vec3 getNormal() const;
+
+    // Möller-Trumbore intersection with the stored edges, returns the distance of the hit or -1.
+    float intersect(const Ray &ray) const;
+
+    // The barycentric u and v of the point where the ray crosses the plane of the triangle, the shader samples the
+    // texture at them.
+    glm::vec2 getBarycentrics(const Ray &ray) const;
+
+    // One record for each triangle of the list, in the same order.
+    static vector<TriangleRecord> buildRecords(const vector<glm::uvec3> &triangles,
+                                               const vector<glm::vec4> &coordinates);
+
+    // Rebuilds the records of the triangles with a moved vertex and sets changedRecords[i] for each of them.
+    static void updateRecords(vector<TriangleRecord> &records, const vector<glm::uvec3> &triangles,
+                              const vector<glm::vec4> &coordinates, const vector<char> &movedVertices,
+                              vector<char> &changedRecords);
+};
+
+#endif //RAYTRACERBOROS_TRIANGLERECORD_H
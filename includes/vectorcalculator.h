@@ -10,17 +10,19 @@
 #include "glm/detail/type_vec1.hpp"
 #include "glm/gtc/type_ptr.hpp"
 
-float dot(const glm::vec3& v1, const glm::vec3& v2) { return (v1.x * v2.x + v1.y * v2.y + v1.z * v2.z); }
+// Inline, so every translation unit that includes light.h can include it.
 
-float getLength(glm::vec3 &param) { return sqrtf(dot(param, param)); }
+inline float dot(const glm::vec3& v1, const glm::vec3& v2) { return (v1.x * v2.x + v1.y * v2.y + v1.z * v2.z); }
 
-glm::vec3 normalize(glm::vec3 &param) { return param * (1 / getLength(param)); }
+inline float getLength(glm::vec3 &param) { return sqrtf(dot(param, param)); }
 
-glm::vec3 cross(const glm::vec3& v1, const glm::vec3& v2) {
+inline glm::vec3 normalize(glm::vec3 &param) { return param * (1 / getLength(param)); }
+
+inline glm::vec3 cross(const glm::vec3& v1, const glm::vec3& v2) {
     return glm::vec3(v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x);
 }
 
-glm::vec4 mvpCalculator(glm::mat4 model, glm::mat4 view, glm::mat4 projection, glm::vec4 coordinates){
+inline glm::vec4 mvpCalculator(glm::mat4 model, glm::mat4 view, glm::mat4 projection, glm::vec4 coordinates){
     return model * view * projection * coordinates;
 }
 
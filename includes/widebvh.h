@@ -0,0 +1,125 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#ifndef RAYTRACERBOROS_WIDEBVH_H
+#define RAYTRACERBOROS_WIDEBVH_H
+
+#include <array>
+#include <vector>
+#include "glm/glm.hpp"
+#include "bvhnode.h"
+#include "trianglerecord.h"
+
+using namespace std;
+
+/* Node of a wide tree with up to Width children. The bounds of the children are stored per axis (structure of arrays),
+ * so one ray is tested against four children with one SIMD operation on the CPU and one vec4 load in the shader.
+ * A child is an inner node (count 0, child is its node index), a leaf (count > 0, child is its first triangle) or an
+ * empty slot (count -1).
+ */
+template<int Width>
+struct WideBvhNode {
+    float minX[Width];
+    float minY[Width];
+    float minZ[Width];
+    float maxX[Width];
+    float maxY[Width];
+    float maxZ[Width];
+    int child[Width];
+    int count[Width];
+};
+
+/* Collapse of the binary tree into a BVH4 or BVH8. Every wide node takes the children of a binary node and keeps
+ * replacing its inner child with the largest surface by the two children of that one until it has Width children.
+ * The nodes are stored in depth-first pre-order, the root is node 0.
+ */
+template<int Width>
+class WideBvh {
+public:
+    // WIDE_STACK_SIZE of the shader, the traversal stacks of the wide and the compressed trees hold this many entries.
+    static const int shaderStackSize = 128;
+
+    static vector<WideBvhNode<Width>> collapse(const BvhNode &root);
+
+    // The most entries the stack of the traversal holds for any ray. Every node pops its entry and pushes up to Width
+    // hit children, the other children wait on the stack while the first one is walked, so the need grows by up to
+    // Width - 1 per level.
+    static int getStackSize(const vector<WideBvhNode<Width>> &nodes);
+
+    // Closest-hit traversal on the CPU, it counts the visited wide nodes and the tested triangles of one ray.
+    static void traceForStatistics(const vector<WideBvhNode<Width>> &nodes, const vector<TriangleRecord> &leafRecords,
+                                   const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles);
+
+    // The traversal behind traceForStatistics, nodeAt(i) returns node i (stored or decoded from another format).
+    template<typename NodeAt>
+    static void traverse(const vector<TriangleRecord> &leafRecords, const Ray &ray, float &closestT,
+                         int &visitedNodes, int &testedTriangles, const NodeAt &nodeAt);
+
+private:
+    static int collapseNode(const BvhNode &node, vector<WideBvhNode<Width>> &nodes);
+
+    // Tests the ray against the boxes of the children, bit i of the result is set if child i is hit before maxT.
+    static int intersectChildren(const WideBvhNode<Width> &node, const Ray &ray, const glm::vec3 &invDir, float maxT,
+                                 float entryT[Width]);
+};
+
+template<int Width>
+template<typename NodeAt>
+void WideBvh<Width>::traverse(const vector<TriangleRecord> &leafRecords, const Ray &ray, float &closestT,
+                              int &visitedNodes, int &testedTriangles, const NodeAt &nodeAt) {
+    struct StackEntry {
+        int child;
+        int count;
+        float entryT;
+    };
+
+    glm::vec3 invDir = 1.0f / ray.dir;
+    vector<StackEntry> stack;
+    stack.reserve(64);
+    stack.push_back({0, 0, 0});
+
+    while (!stack.empty()) {
+        StackEntry entry = stack.back();
+        stack.pop_back();
+        if (entry.entryT > closestT) {
+            continue;
+        }
+
+        if (entry.count > 0) {
+            for (int j = entry.child; j < entry.child + entry.count; j++) {
+                testedTriangles++;
+                float t = leafRecords[j].intersect(ray);
+                if (t > 0 && t < closestT) {
+                    closestT = t;
+                }
+            }
+            continue;
+        }
+
+        visitedNodes++;
+        const WideBvhNode<Width> &node = nodeAt(entry.child);
+        float entryT[Width];
+        int hitMask = intersectChildren(node, ray, invDir, closestT, entryT);
+
+        // The hit children are pushed from the farthest to the nearest, so the nearest one is visited first.
+        int hitCount = 0;
+        array<int, Width> hitChildren;
+        for (int i = 0; i < Width; i++) {
+            if (hitMask & (1 << i)) {
+                hitChildren[hitCount++] = i;
+            }
+        }
+        for (int a = 1; a < hitCount; a++) {
+            for (int b = a; b > 0 && entryT[hitChildren[b]] > entryT[hitChildren[b - 1]]; b--) {
+                swap(hitChildren[b], hitChildren[b - 1]);
+            }
+        }
+        for (int h = 0; h < hitCount; h++) {
+            int i = hitChildren[h];
+            stack.push_back({node.child[i], node.count[i], entryT[i]});
+        }
+    }
+}
+
+#endif //RAYTRACERBOROS_WIDEBVH_H
@@ -0,0 +1,50 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "../includes/allocationcounter.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+static std::atomic<size_t> numberOfAllocations(0);
+
+void *operator new(size_t size) {
+    numberOfAllocations.fetch_add(1, std::memory_order_relaxed);
+    void *memory = malloc(size == 0 ? 1 : size);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+bool AllocationCounter::isEnabled() {
+    return true;
+}
+
+size_t AllocationCounter::getNumberOfAllocations() {
+    return numberOfAllocations.load();
+}
+
+#else
+
+bool AllocationCounter::isEnabled() {
+    return false;
+}
+
+size_t AllocationCounter::getNumberOfAllocations() {
+    return 0;
+}
+
+#endif
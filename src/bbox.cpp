@@ -2,13 +2,15 @@
 // Created by fox1942 on 11/9/20.
 //
 
+#include <future>
+
 #include "../includes/bbox.h"
+#include "../includes/glm/glm.hpp"
 
-BBox::BBox(glm::vec3 min, glm::vec3 max, glm::vec3 center, vector<glm::vec3> faceCenters) :
+BBox::BBox(glm::vec3 min, glm::vec3 max, glm::vec3 center) :
         min(min),
         max(max),
-        center(center),
-        faceCenters(faceCenters) {
+        center(center) {
 
     float length = max.x - min.x;
     float width = max.y - min.y;
@@ -25,58 +27,74 @@ glm::vec3 BBox::calculateCenterofTriangle(glm::vec3 vec, glm::vec3 vec1, glm::ve
                      float((vec.z + vec1.z + vec2.z) / 3));
 }
 
-glm::vec3 BBox::getCoordinatesfromIndex(float index) {
+glm::vec3 BBox::getCoordinatesfromIndex(unsigned int index) {
     return BBox::primitiveCoordinates.at(index);
 }
 
-BBox BBox::getBBox(vector<glm::vec4> &indices) {
-    vector<glm::vec3> faceCenters;
-    glm::vec3 center(0, 0, 0);
-
-    float minX = 99999, maxX = -99999;
-    float minY = 99999, maxY = -99999;
-    float minZ = 99999, maxZ = -99999;
-
-    glm::vec3 firstCoordofTri;
-    glm::vec3 secondCoordofTri;
-    glm::vec3 thirdCoordofTri;
-
-
-    for (const glm::vec4 index : indices) {
+void BBox::reduceRange(const BuildPrimitives &primitives, int begin, int end, glm::vec3 &minp, glm::vec3 &maxp,
+                       glm::vec3 &centerSum) {
+    minp = glm::vec3(99999, 99999, 99999);
+    maxp = glm::vec3(-99999, -99999, -99999);
 
-        firstCoordofTri = getCoordinatesfromIndex(index.x);
-        secondCoordofTri = getCoordinatesfromIndex(index.y);
-        thirdCoordofTri = getCoordinatesfromIndex(index.z);
+    for (int i = begin; i < end; i++) {
+        int triangle = primitives.triangleOrder[i];
 
-        vector<glm::vec3> currentTri;
-        currentTri.push_back(firstCoordofTri);
-        currentTri.push_back(secondCoordofTri);
-        currentTri.push_back(thirdCoordofTri);
-
-        for (int j = 0; j < currentTri.size(); j++) {
-
-            minX = MIN(currentTri.at(j).x, minX);
-            minY = MIN(currentTri.at(j).y, minY);
-            minZ = MIN(currentTri.at(j).z, minZ);
+        minp = glm::min(minp, primitives.minBounds[triangle]);
+        maxp = glm::max(maxp, primitives.maxBounds[triangle]);
+        centerSum += primitives.centroids[triangle];
+    }
+}
 
-            maxX = MAX(currentTri.at(j).x, maxX);
-            maxY = MAX(currentTri.at(j).y, maxY);
-            maxZ = MAX(currentTri.at(j).z, maxZ);
+BBox BBox::getBBox(const BuildPrimitives &primitives, int begin, int end, int taskCount) {
+    glm::vec3 center(0, 0, 0);
+    glm::vec3 minp;
+    glm::vec3 maxp;
+
+    if (taskCount <= 1) {
+        reduceRange(primitives, begin, end, minp, maxp, center);
+    } else {
+        // Every task reduces its own chunk, the calling thread the last one. The partial bounds and centroid sums are
+        // merged afterwards.
+        vector<glm::vec3> chunkMin(taskCount);
+        vector<glm::vec3> chunkMax(taskCount);
+        vector<glm::vec3> chunkCenter(taskCount, glm::vec3(0, 0, 0));
+        vector<future<void>> tasks;
+
+        int chunkSize = (end - begin + taskCount - 1) / taskCount;
+        for (int t = 0; t < taskCount - 1; t++) {
+            int chunkBegin = MIN(begin + t * chunkSize, end);
+            int chunkEnd = MIN(chunkBegin + chunkSize, end);
+            tasks.push_back(async(launch::async, &BBox::reduceRange, cref(primitives), chunkBegin, chunkEnd,
+                                  ref(chunkMin[t]), ref(chunkMax[t]), ref(chunkCenter[t])));
+        }
+        int lastBegin = MIN(begin + (taskCount - 1) * chunkSize, end);
+        reduceRange(primitives, lastBegin, end, chunkMin[taskCount - 1], chunkMax[taskCount - 1],
+                    chunkCenter[taskCount - 1]);
+
+        minp = glm::vec3(99999, 99999, 99999);
+        maxp = glm::vec3(-99999, -99999, -99999);
+        for (int t = 0; t < taskCount; t++) {
+            if (t < taskCount - 1) {
+                tasks[t].get();
+            }
+            minp = glm::min(minp, chunkMin[t]);
+            maxp = glm::max(maxp, chunkMax[t]);
+            center += chunkCenter[t];
         }
-
-        glm::vec3 centerOfCurrTri(calculateCenterofTriangle(firstCoordofTri, secondCoordofTri, thirdCoordofTri));
-
-        faceCenters.push_back(centerOfCurrTri);
-
-        center += centerOfCurrTri;
     }
 
-    center /= indices.size(); // Calculating the average centroid of the bounding box.
+    center /= float(end - begin); // Calculating the average centroid of the bounding box.
 
-    glm::vec3 minp(minX, minY, minZ);
-    glm::vec3 maxp(maxX, maxY, maxZ);
+    return BBox(minp, maxp, center);
+}
 
-    return BBox(minp, maxp, center, faceCenters);
+float BBox::getSurfaceArea() const {
+    return getSurfaceArea(min, max);
+}
+
+float BBox::getSurfaceArea(const glm::vec3 &min, const glm::vec3 &max) {
+    glm::vec3 extent = max - min;
+    return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
 }
 
 const vector<glm::vec4> &BBox::getPrimitiveCoordinates() {
@@ -114,11 +132,3 @@ int BBox::getLongestAxis() const {
 void BBox::setLongestAxis(int longestAxis) {
     BBox::longestAxis = longestAxis;
 }
-
-const vector<glm::vec3> &BBox::getFaceCenters() const {
-    return faceCenters;
-}
-
-void BBox::setFaceCenters(const vector<glm::vec3> &faceCenters) {
-    BBox::faceCenters = faceCenters;
-}
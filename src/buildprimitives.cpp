@@ -0,0 +1,50 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <future>
+
+#include "../includes/buildprimitives.h"
+#include "../includes/glm/glm.hpp"
+
+BuildPrimitives::BuildPrimitives(const vector<glm::uvec3> &indices, const vector<glm::vec4> &coordinates,
+                                 int taskCount) :
+        indices(&indices),
+        centroids(indices.size()),
+        minBounds(indices.size()),
+        maxBounds(indices.size()),
+        triangleOrder(indices.size()) {
+
+    if (taskCount <= 1) {
+        computeRange(coordinates, 0, indices.size());
+        return;
+    }
+
+    vector<future<void>> tasks;
+    int chunkSize = (int(indices.size()) + taskCount - 1) / taskCount;
+    for (int begin = 0; begin < indices.size(); begin += chunkSize) {
+        int end = min(begin + chunkSize, int(indices.size()));
+        tasks.push_back(async(launch::async, &BuildPrimitives::computeRange, this, cref(coordinates), begin, end));
+    }
+    for (future<void> &task : tasks) {
+        task.get();
+    }
+}
+
+void BuildPrimitives::computeRange(const vector<glm::vec4> &coordinates, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        const glm::uvec3 &triangle = indices->at(i);
+        glm::vec3 first(coordinates.at(triangle.x));
+        glm::vec3 second(coordinates.at(triangle.y));
+        glm::vec3 third(coordinates.at(triangle.z));
+
+        minBounds[i] = glm::min(first, glm::min(second, third));
+        maxBounds[i] = glm::max(first, glm::max(second, third));
+        centroids[i] = (first + second + third) / 3.0f;
+        triangleOrder[i] = i;
+    }
+}
+
+int BuildPrimitives::size() const {
+    return triangleOrder.size();
+}
@@ -0,0 +1,203 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../includes/bvhcache.h"
+
+static const char cacheMagic[8] = {'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E'};
+
+// The sections start at multiples of 64 bytes, so the mapped vectors and nodes are aligned.
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + 63) / 64 * 64;
+}
+
+// Maps a whole file for reading, nullptr if it can't be opened.
+static void *mapFile(const string &path, size_t &size) {
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file == -1) {
+        return nullptr;
+    }
+    struct stat status;
+    void *data = nullptr;
+    if (fstat(file, &status) == 0 && status.st_size > 0) {
+        size = status.st_size;
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data == MAP_FAILED) {
+            data = nullptr;
+        }
+    }
+    ::close(file);
+    return data;
+}
+
+BvhCache::BvhCache() : mapping(nullptr), mappingSize(0), header(nullptr) {
+}
+
+BvhCache::~BvhCache() {
+    close();
+}
+
+void BvhCache::close() {
+    if (mapping != nullptr) {
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+}
+
+uint64_t BvhCache::hashBytes(const void *data, size_t size, uint64_t hash) {
+    const uint64_t prime = 0x100000001b3ULL;
+    const unsigned char *bytes = (const unsigned char *) data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    return hash;
+}
+
+// The content of the file, then of the material libraries an OBJ file names, they hold the colours of the triangles.
+uint64_t BvhCache::hashFile(const string &path, uint64_t hash) {
+    size_t size = 0;
+    const char *data = (const char *) mapFile(path, size);
+    if (data == nullptr) {
+        return hashBytes(path.data(), path.size(), hash);
+    }
+    hash = hashBytes(data, size, hash);
+
+    vector<string> libraries;
+    const string keyword = "mtllib ";
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0) {
+        for (size_t i = 0; i + keyword.size() < size; i++) {
+            if ((i == 0 || data[i - 1] == '\n') && memcmp(data + i, keyword.data(), keyword.size()) == 0) {
+                size_t end = i + keyword.size();
+                while (end < size && data[end] != '\n' && data[end] != '\r') {
+                    end++;
+                }
+                libraries.push_back(string(data + i + keyword.size(), data + end));
+            }
+        }
+    }
+    munmap((void *) data, size);
+
+    string directory = path.substr(0, path.find_last_of('/') + 1);
+    for (const string &library : libraries) {
+        hash = hashFile(directory + library, hash);
+    }
+    return hash;
+}
+
+uint64_t BvhCache::computeKey(const Settings &settings) {
+    uint64_t hash = hashFile(settings.modelPath, 0xcbf29ce484222325ULL);
+
+    // The settings that change the tree or the order of the triangles and vertices, field by field, no padding bytes.
+    const BvhSettings &bvh = settings.bvh;
+    auto add = [&](const auto &value) { hash = hashBytes(&value, sizeof(value), hash); };
+    add(int(bvh.builderType));
+    add(int(bvh.splitMethod));
+    add(bvh.sahBins);
+    add(bvh.maxLeafSize);
+    add(bvh.maxDepth);
+    add(bvh.traversalCost);
+    add(bvh.intersectionCost);
+    add(bvh.mortonBits);
+    add(bvh.spatialSplitBudget);
+    add(bvh.spatialSplitAlpha);
+    add(bvh.optimizeTreelets);
+    add(bvh.treeletLeaves);
+    add(bvh.treeletPasses);
+    add(bvh.treeletTimeBudget);
+    add(settings.reorderVertices);
+    return hash;
+}
+
+string BvhCache::getCachePath(const string &modelPath) {
+    return modelPath + ".bvhcache";
+}
+
+bool BvhCache::open(const string &path, uint64_t key) {
+    close();
+    mapping = mapFile(path, mappingSize);
+    if (mapping == nullptr) {
+        return false;
+    }
+
+    header = (const Header *) mapping;
+    bool valid = mappingSize >= sizeof(Header) && memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+                 header->version == version && header->sectionCount == SectionCount && header->key == key;
+    for (int i = 0; valid && i < SectionCount; i++) {
+        valid = header->offsets[i] <= mappingSize &&
+                header->counts[i] * header->elementSizes[i] <= mappingSize - header->offsets[i];
+    }
+    if (!valid) {
+        close();
+    }
+    return valid;
+}
+
+bool BvhCache::readScene(Model &model, vector<FlatBvhNode> &flatNodes, vector<TriangleRecord> &leafRecords) const {
+    return copySection(Positions, model.allPositionVertices) && copySection(Triangles, model.indicesInModel) &&
+           copySection(TriangleMaterials, model.materialIndicesInModel) && copySection(Materials, model.materials) &&
+           copySection(Nodes, flatNodes) && copySection(Records, leafRecords);
+}
+
+bool BvhCache::write(const string &path, uint64_t key, const SectionData (&sections)[SectionCount]) {
+    Header fileHeader = {};
+    memcpy(fileHeader.magic, cacheMagic, sizeof(cacheMagic));
+    fileHeader.version = version;
+    fileHeader.sectionCount = SectionCount;
+    fileHeader.key = key;
+    uint64_t offset = alignSection(sizeof(Header));
+    for (int i = 0; i < SectionCount; i++) {
+        fileHeader.offsets[i] = offset;
+        fileHeader.counts[i] = sections[i].count;
+        fileHeader.elementSizes[i] = sections[i].elementSize;
+        offset = alignSection(offset + sections[i].count * sections[i].elementSize);
+    }
+
+    string temporaryPath = path + ".tmp";
+    ofstream file(temporaryPath, ios::binary | ios::trunc);
+    if (!file) {
+        return false;
+    }
+    const char zeros[64] = {};
+    file.write((const char *) &fileHeader, sizeof(fileHeader));
+    uint64_t written = sizeof(fileHeader);
+    for (int i = 0; i < SectionCount; i++) {
+        file.write(zeros, fileHeader.offsets[i] - written);
+        file.write((const char *) sections[i].data, sections[i].count * sections[i].elementSize);
+        written = fileHeader.offsets[i] + sections[i].count * sections[i].elementSize;
+    }
+    file.close();
+
+    if (!file || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool BvhCache::writeScene(const string &path, uint64_t key, const Model &model, const vector<FlatBvhNode> &flatNodes,
+                          const vector<TriangleRecord> &leafRecords) {
+    SectionData sections[SectionCount] = {
+            {model.allPositionVertices.data(), model.allPositionVertices.size(), sizeof(glm::vec4)},
+            {model.indicesInModel.data(), model.indicesInModel.size(), sizeof(glm::uvec3)},
+            {model.materialIndicesInModel.data(), model.materialIndicesInModel.size(), sizeof(unsigned int)},
+            {model.materials.data(), model.materials.size(), sizeof(Material)},
+            {flatNodes.data(), flatNodes.size(), sizeof(FlatBvhNode)},
+            {leafRecords.data(), leafRecords.size(), sizeof(TriangleRecord)}};
+    return write(path, key, sections);
+}
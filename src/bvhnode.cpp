@@ -5,233 +5,457 @@
 #include <iostream>
 #include <vector>
 #include <deque>
+#include <atomic>
+#include <future>
+#include <algorithm>
+#include <array>
+#include <type_traits>
 
 #include "../includes/bbox.h"
 #include "../includes/glm/glm.hpp"
 #include "../includes/bvhnode.h"
+#include "../includes/splitbvhbuilder.h"
+#include "../includes/treeletoptimizer.h"
 
 using namespace std;
 
-int numberOf = 1;
-int numberOfLeaves = 0;
-int indOrder = 0;
+// Number of subtrees being built on worker threads at the moment.
+atomic<int> runningBuildTasks(0);
 
+// A subtree goes to a new thread if the node is large enough and there is a free thread for it.
+static bool claimBuildThread(int count, const BvhSettings &settings) {
+    if (count < settings.parallelBuildCutoff) {
+        return false;
+    }
+    if (runningBuildTasks.fetch_add(1) < settings.buildThreads - 1) {
+        return true;
+    }
+    runningBuildTasks--;
+    return false;
+}
 
-BvhNode::~BvhNode() {
-    if (this->children.size() != 0) {
-        delete this->children.at(0);
-        delete this->children.at(1);
+// The threads that help reducing the bounds of a large node come from the same budget as the subtree tasks, so the
+// reductions of the upper levels do not start new threads while the sibling subtrees keep the others busy. Returns the
+// number of claimed threads, they are given back with runningBuildTasks -= claimed.
+static int claimReductionThreads(int count, const BvhSettings &settings) {
+    if (count < settings.parallelBuildCutoff * settings.buildThreads) {
+        return 0;
     }
-    this->children.clear();
+    int claimed = 0;
+    while (claimed < settings.buildThreads - 1) {
+        if (runningBuildTasks.fetch_add(1) >= settings.buildThreads - 1) {
+            runningBuildTasks--;
+            break;
+        }
+        claimed++;
+    }
+    return claimed;
 }
 
-BvhNode::BvhNode(const BvhNode &node) :
-        bBox(node.bBox),
-        depthOfNode(node.depthOfNode),
-        order(node.order),
-        isLeaf(node.isLeaf),
-        createdEmpty(node.createdEmpty),
-        leftOrRight(node.leftOrRight),
-        indices(node.indices){
 
-    if (!node.children.empty()) {
-        BvhNode *left = new BvhNode(*node.children.at(0));
-        BvhNode *right = new BvhNode(*node.children.at(1));
+// The arena frees the nodes without running their destructors.
+static_assert(is_trivially_destructible<BvhNode>::value, "BvhNode must not own memory");
 
-        this->children.push_back(left);
-        this->children.push_back(right);
+vector<int> BvhNode::buildTree(const vector<glm::uvec3> &indices, const BvhSettings &settings,
+                               BvhNodeArena &arena) {
+    BuildPrimitives primitives(indices, BBox::getPrimitiveCoordinates(),
+                               indices.size() >= settings.parallelBuildCutoff ? settings.buildThreads : 1);
+    vector<int> triangleIndices;
+    if (settings.builderType == BuilderType::Spatial) {
+        SplitBvhBuilder builder(primitives, BBox::getPrimitiveCoordinates(), settings, arena);
+        builder.build(this);
+        cout << "Split BVH: " << builder.getNumberOfSpatialSplits() << " spatial splits, "
+             << builder.getNumberOfReferences() << " triangle references for " << primitives.size()
+             << " triangles." << endl;
+        triangleIndices.swap(builder.getTriangleIndices());
+    } else {
+        // The leaves of these builders are ranges of the partitioned triangle order.
+        // A binary tree over n triangles has at most 2n - 1 nodes, they fit in one block of the arena.
+        arena.reserve(2 * primitives.size());
+        if (settings.builderType == BuilderType::Linear) {
+            buildLinearTree(primitives, settings, arena);
+        } else {
+            buildSubtree(primitives, 0, primitives.size(), 0, settings, arena);
+        }
+        triangleIndices.swap(primitives.triangleOrder);
     }
-   // printf("Copy constructorban vagyok!\n");
+
+    int nextOrder = 0;
+    assignOrder(nextOrder);
+
+    if (settings.optimizeTreelets && !this->isLeaf) {
+        float costBefore = getSahCost(settings);
+        auto optimizationStart = chrono::steady_clock::now();
+        TreeletOptimizer optimizer(settings);
+        optimizer.optimize(this, triangleIndices);
+        chrono::duration<double, milli> optimizationTime = chrono::steady_clock::now() - optimizationStart;
+        cout << "Treelet optimization: SAH cost " << costBefore << " -> " << getSahCost(settings) << ", "
+             << optimizer.getRestructuredTreelets() << " treelets restructured in " << optimizationTime.count()
+             << " ms" << (optimizer.getTimedOut() ? " (time budget reached)" : "") << endl;
+
+        nextOrder = 0;
+        assignOrder(nextOrder);
+    }
+    numberOfPolyInTheLeafWithLargestNumberOfPoly = findLargestLeaf();
+    return triangleIndices;
 }
 
-void swap(BvhNode &first, BvhNode &second) {
-    printf("Swap-ban vagyok!\n");
+void BvhNode::buildSubtree(BuildPrimitives &primitives, int begin, int end, int depth, const BvhSettings &settings,
+                           BvhNodeArena &arena) {
+    int count = end - begin;
+
+    // Only the top levels are large enough to be worth reducing on several threads.
+    int reductionThreads = claimReductionThreads(count, settings);
 
-    std::swap(first.bBox, second.bBox);
-    std::swap(first.depthOfNode, second.depthOfNode);
-    std::swap(first.order, second.order);
-    std::swap(first.isLeaf, second.isLeaf);
-    std::swap(first.createdEmpty, second.createdEmpty);
-    std::swap(first.leftOrRight, second.leftOrRight);
+    this->depthOfNode = depth;
+    this->bBox = BBox::getBBox(primitives, begin, end, reductionThreads + 1);
+    runningBuildTasks -= reductionThreads;
 
-    if (!second.getChildren().empty()) {
-        std::swap(first.children.at(0), second.children.at(0));
-        std::swap(first.children.at(1), second.children.at(1));
+    if (count <= settings.maxLeafSize || depth >= settings.maxDepth) {
+        makeLeaf(begin, end);
+        return;
     }
 
-    std::swap(first.indices, second.indices);
+    int middle;
+    if (settings.splitMethod == SplitMethod::BinnedSah) {
+        middle = splitWithBinnedSah(primitives, begin, end, settings);
+    } else {
+        middle = splitAtAverageCentroid(primitives, begin, end);
+    }
+
+    if (middle == begin || middle == end) {
+        makeLeaf(begin, end);
+        return;
+    }
+
+    this->isLeaf = false;
+
+    BvhNode *left = arena.allocate(2);
+    BvhNode *right = left + 1;
+
+    if (claimBuildThread(count, settings)) {
+        future<void> leftTask = async(launch::async, &BvhNode::buildSubtree, left, ref(primitives), begin, middle,
+                                      this->depthOfNode + 1, cref(settings), ref(arena));
+        right->buildSubtree(primitives, middle, end, this->depthOfNode + 1, settings, arena);
+        leftTask.get();
+        runningBuildTasks--;
+    } else {
+        left->buildSubtree(primitives, begin, middle, this->depthOfNode + 1, settings, arena);
+        right->buildSubtree(primitives, middle, end, this->depthOfNode + 1, settings, arena);
+    }
+
+    left->leftOrRight = 0;
+    right->leftOrRight = 1;
+
+    children[0] = left;
+    children[1] = right;
+
+
+    return;
 }
 
-BvhNode &BvhNode::operator=(BvhNode other) {
-    printf("Assigment operatorban vagyok!\n");
-    swap(*this, other);
-    return *this;
+void BvhNode::makeLeaf(int begin, int end) {
+    this->isLeaf = true;
+    this->firstIndex = begin;
+    this->indexCount = end - begin;
 }
 
-void BvhNode::buildTree(vector<glm::vec4> &indices, int depth) {
+void BvhNode::buildLinearTree(BuildPrimitives &primitives, const BvhSettings &settings, BvhNodeArena &arena) {
+    int taskCount = primitives.size() >= settings.parallelBuildCutoff ? settings.buildThreads : 1;
 
-    if (indices.size() <= numberOfPolygonsInModel / 3) {
-        if (indices.size() > numberOfPolyInTheLeafWithLargestNumberOfPoly) {
-            numberOfPolyInTheLeafWithLargestNumberOfPoly = indices.size();
-        }
-        //cout << "numberOfPolyInTheLeafWithLargestNumberOfPoly: " << numberOfPolyInTheLeafWithLargestNumberOfPoly   << endl;
-
-        this->bBox = BBox();
-        this->indices = indices;
-        this->depthOfNode = depth;
-        this->isLeaf = true;
-        this->order = indOrder;
-        this->createdEmpty = false;
-        indOrder++;
+    vector<uint64_t> sortedCodes = Lbvh::sortByMortonCode(primitives, settings.mortonBits, taskCount);
+    vector<LbvhNode> lbvhNodes = Lbvh::emitHierarchy(sortedCodes, taskCount);
+
+    emitLinearSubtree(lbvhNodes, primitives, 0, primitives.size() - 1, 0, 0, settings, arena);
+}
+
+void BvhNode::emitLinearSubtree(const vector<LbvhNode> &lbvhNodes, BuildPrimitives &primitives, int first, int last,
+                                int lbvhNode, int depth, const BvhSettings &settings, BvhNodeArena &arena) {
+    int count = last - first + 1;
+
+    this->depthOfNode = depth;
+
+    // The radix tree has one triangle in every leaf, the small subtrees are collapsed into one leaf.
+    if (count <= settings.maxLeafSize || depth >= settings.maxDepth) {
+        this->bBox = BBox::getBBox(primitives, first, last + 1);
+        makeLeaf(first, last + 1);
         return;
     }
 
-    this->depthOfNode = depth;
-    this->bBox = bBox.getBBox(indices);
+    this->isLeaf = false;
+
+    const LbvhNode &node = lbvhNodes[lbvhNode];
+    BvhNode *left = arena.allocate(2);
+    BvhNode *right = left + 1;
+
+    // The left child of node i is the internal node at the split, the right one is the internal node after it.
+    if (claimBuildThread(count, settings)) {
+        future<void> leftTask = async(launch::async, &BvhNode::emitLinearSubtree, left, cref(lbvhNodes),
+                                      ref(primitives), node.first, node.split, node.split, depth + 1, cref(settings),
+                                      ref(arena));
+        right->emitLinearSubtree(lbvhNodes, primitives, node.split + 1, node.last, node.split + 1, depth + 1, settings,
+                                 arena);
+        leftTask.get();
+        runningBuildTasks--;
+    } else {
+        left->emitLinearSubtree(lbvhNodes, primitives, node.first, node.split, node.split, depth + 1, settings,
+                                arena);
+        right->emitLinearSubtree(lbvhNodes, primitives, node.split + 1, node.last, node.split + 1, depth + 1, settings,
+                                 arena);
+    }
 
-    this->order = indOrder;
-    indOrder++;
+    // The bounds are merged bottom-up from the children, so the conversion stays linear.
+    int leftCount = node.split - node.first + 1;
+    int rightCount = node.last - node.split;
+    this->bBox = BBox(glm::min(left->bBox.getMin(), right->bBox.getMin()),
+                      glm::max(left->bBox.getMax(), right->bBox.getMax()),
+                      (left->bBox.getCenter() * float(leftCount) + right->bBox.getCenter() * float(rightCount)) /
+                      float(count));
 
-    int axis = this->bBox.getLongestAxis();
+    left->leftOrRight = 0;
+    right->leftOrRight = 1;
+
+    children[0] = left;
+    children[1] = right;
+}
 
-    vector<glm::vec4> leftTree;
-    vector<glm::vec4> rightTree;
-
-    for (int i = 0; i < indices.size(); ++i) {
-        switch (axis) {
-            case 0:
-                if (bBox.getCenter().x >= this->bBox.getFaceCenters().at(i).x) {
-                    leftTree.push_back(indices.at(i));
-                } else if (bBox.getCenter().x < this->bBox.getFaceCenters().at(i).x) {
-                    rightTree.push_back(indices.at(i));
-                }
-                break;
-            case 1:
-                if (bBox.getCenter().y >= this->bBox.getFaceCenters().at(i).y) {
-                    leftTree.push_back(indices.at(i));
-                } else if (bBox.getCenter().y < this->bBox.getFaceCenters().at(i).y) {
-                    rightTree.push_back(indices.at(i));
-                }
-                break;
-            case 2:
-                if (bBox.getCenter().z >= this->bBox.getFaceCenters().at(i).z) {
-                    leftTree.push_back(indices.at(i));
-                } else if (bBox.getCenter().z < this->bBox.getFaceCenters().at(i).z) {
-                    rightTree.push_back(indices.at(i));
-                }
-        };
+// Numbering the nodes in the same depth-first order as the recursion visits them.
+void BvhNode::assignOrder(int &nextOrder) {
+    this->order = nextOrder;
+    nextOrder++;
+
+    if (!this->isLeaf) {
+        children[0]->assignOrder(nextOrder);
+        children[1]->assignOrder(nextOrder);
     }
+}
 
-    if (leftTree.size() == indices.size() || rightTree.size() == indices.size()) {
-        this->indices = indices;
-        this->isLeaf = true;
-        if (indices.size() > numberOfPolyInTheLeafWithLargestNumberOfPoly) {
-            numberOfPolyInTheLeafWithLargestNumberOfPoly = indices.size();
-        }
+int BvhNode::findLargestLeaf() const {
+    if (this->isLeaf) {
+        return this->indexCount;
+    }
+
+    int largestInLeft = children[0]->findLargestLeaf();
+    int largestInRight = children[1]->findLargestLeaf();
+    return MAX(largestInLeft, largestInRight);
+}
+
+int BvhNode::splitAtAverageCentroid(BuildPrimitives &primitives, int begin, int end) {
+    int axis = this->bBox.getLongestAxis();
+    float center = this->bBox.getCenter()[axis];
 
-     //   cout << "numberOfPolyInTheLeafWithLargestNumberOfPoly: " << numberOfPolyInTheLeafWithLargestNumberOfPoly << endl;
+    auto middle = partition(primitives.triangleOrder.begin() + begin, primitives.triangleOrder.begin() + end,
+                            [&](int triangle) { return primitives.centroids[triangle][axis] <= center; });
 
-        return;
+    return middle - primitives.triangleOrder.begin();
+}
+
+static int sahBinOfCenter(float center, float centerMin, float scale, int binCount) {
+    int bin = int((center - centerMin) * scale);
+    return MIN(MAX(bin, 0), binCount - 1);
+}
+
+/* The centroids are sorted into equally sized bins along every axis. For each of the (binCount-1) planes between the bins
+ * the cost  C_trav + C_isect * (A_left * N_left + A_right * N_right) / A_parent  is evaluated with a sweep from both ends
+ * and the cheapest plane of the three axes is taken. Triangles with a centroid in a bin left of the plane go to the left.
+ */
+int BvhNode::splitWithBinnedSah(BuildPrimitives &primitives, int begin, int end, const BvhSettings &settings) {
+    struct SahBin {
+        glm::vec3 min;
+        glm::vec3 max;
+        int count;
+    };
+
+    const int maxBinCount = 32;
+    const int binCount = MIN(settings.sahBins, maxBinCount);
+    const int count = end - begin;
+
+    glm::vec3 centerMin(99999, 99999, 99999);
+    glm::vec3 centerMax(-99999, -99999, -99999);
+
+    for (int i = begin; i < end; i++) {
+        const glm::vec3 &centroid = primitives.centroids[primitives.triangleOrder[i]];
+        centerMin = glm::min(centerMin, centroid);
+        centerMax = glm::max(centerMax, centroid);
     }
 
-    cout << "Left: " << leftTree.size() << endl;
-    cout << "Right: " << rightTree.size() << endl;
+    float parentArea = this->bBox.getSurfaceArea();
+    float bestCost = 3.402823466e+38f;
+    int bestAxis = -1;
+    int bestPlane = -1;
 
-    BvhNode *left = new BvhNode();
-    BvhNode *right = new BvhNode();
+    array<SahBin, maxBinCount> bins;
+    array<float, maxBinCount> rightCost;
 
-    left->buildTree(leftTree, this->depthOfNode + 1);
-    right->buildTree(rightTree, this->depthOfNode + 1);
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centerMax[axis] - centerMin[axis];
+        if (extent <= 0) {
+            continue;
+        }
+        float scale = binCount / extent;
 
-    left->leftOrRight = 0;
-    children.push_back(left);
+        for (int b = 0; b < binCount; b++) {
+            bins[b].min = glm::vec3(99999, 99999, 99999);
+            bins[b].max = glm::vec3(-99999, -99999, -99999);
+            bins[b].count = 0;
+        }
 
-    right->leftOrRight = 1;
-    children.push_back(right);
+        for (int i = begin; i < end; i++) {
+            int triangle = primitives.triangleOrder[i];
+            SahBin &bin = bins[sahBinOfCenter(primitives.centroids[triangle][axis], centerMin[axis], scale, binCount)];
+            bin.min = glm::min(bin.min, primitives.minBounds[triangle]);
+            bin.max = glm::max(bin.max, primitives.maxBounds[triangle]);
+            bin.count++;
+        }
 
+        // Sweeping from the right: rightCost[p] belongs to the bins after plane p.
+        glm::vec3 accumulatedMin(99999, 99999, 99999);
+        glm::vec3 accumulatedMax(-99999, -99999, -99999);
+        int accumulatedCount = 0;
+        for (int plane = binCount - 2; plane >= 0; plane--) {
+            accumulatedMin = glm::min(accumulatedMin, bins[plane + 1].min);
+            accumulatedMax = glm::max(accumulatedMax, bins[plane + 1].max);
+            accumulatedCount += bins[plane + 1].count;
+            rightCost[plane] = accumulatedCount == 0 ? 0 :
+                               BBox::getSurfaceArea(accumulatedMin, accumulatedMax) * accumulatedCount;
+        }
 
-    return;
-}
+        // Sweeping from the left and evaluating each plane.
+        accumulatedMin = glm::vec3(99999, 99999, 99999);
+        accumulatedMax = glm::vec3(-99999, -99999, -99999);
+        accumulatedCount = 0;
+        for (int plane = 0; plane < binCount - 1; plane++) {
+            accumulatedMin = glm::min(accumulatedMin, bins[plane].min);
+            accumulatedMax = glm::max(accumulatedMax, bins[plane].max);
+            accumulatedCount += bins[plane].count;
+
+            if (accumulatedCount == 0 || accumulatedCount == count) {
+                continue;
+            }
+
+            float cost = settings.traversalCost + settings.intersectionCost *
+                         (BBox::getSurfaceArea(accumulatedMin, accumulatedMax) * accumulatedCount + rightCost[plane]) /
+                         parentArea;
+
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestPlane = plane;
+            }
+        }
+    }
 
-int BvhNode::countNodes() {
-    for (int i = 0; i < this->children.size(); i++) {
-        numberOf++;
-        children.at(i)->countNodes();
+    // Every centroid is in the same place, no plane can separate the triangles.
+    if (bestAxis == -1) {
+        return end;
     }
-    return numberOf;
+
+    float scale = binCount / (centerMax[bestAxis] - centerMin[bestAxis]);
+    auto middle = partition(primitives.triangleOrder.begin() + begin, primitives.triangleOrder.begin() + end,
+                            [&](int triangle) {
+                                return sahBinOfCenter(primitives.centroids[triangle][bestAxis], centerMin[bestAxis],
+                                                      scale, binCount) <= bestPlane;
+                            });
+
+    return middle - primitives.triangleOrder.begin();
 }
 
-int BvhNode::getNumberOfLeaves() {
-    for (int i = 0; i < this->children.size(); i++) {
-        if (children.at(i)->isLeaf) {
-            numberOfLeaves++;
-        }
-        children.at(i)->getNumberOfLeaves();
+int BvhNode::countSubtreeNodes() const {
+    if (this->isLeaf) {
+        return 1;
     }
-    return numberOfLeaves;
+    return 1 + children[0]->countSubtreeNodes() + children[1]->countSubtreeNodes();
 }
 
-int BvhNode::findDeep(int &deepest) {
-    for (int i = 0; i < this->children.size(); i++) {
-        if (this->children.at(i)->depthOfNode > deepest) {
-            deepest = this->children.at(i)->depthOfNode;
-        }
-        children.at(i)->findDeep(deepest);
+float BvhNode::accumulateSahCost(const BvhSettings &settings) const {
+    float area = this->bBox.getSurfaceArea();
+    if (this->isLeaf) {
+        return area * settings.intersectionCost * this->indexCount;
     }
-    return deepest;
+
+    float cost = area * settings.traversalCost;
+    cost += children[0]->accumulateSahCost(settings);
+    cost += children[1]->accumulateSahCost(settings);
+    return cost;
 }
 
-int BvhNode::getDeepestLevel() {
-    int deepest = -1;
-    return findDeep(deepest);
+float BvhNode::getSahCost(const BvhSettings &settings) const {
+    float rootArea = this->bBox.getSurfaceArea();
+    if (rootArea <= 0) {
+        return 0;
+    }
+    return accumulateSahCost(settings) / rootArea;
 }
 
-void BvhNode::treeComplete(int deepestLev) {
-    if (this->children.empty() && this->depthOfNode != deepestLev) {
-        this->isLeaf = true; // Commented, because semantically 'this' would remain a leaf;
+float BvhNode::accumulateSiblingOverlap() const {
+    if (this->isLeaf) {
+        return 0;
+    }
 
-        BvhNode *emptyNode = new BvhNode();
-        emptyNode->createdEmpty = true;
-        emptyNode->isLeaf = false;
-        emptyNode->order = -1;
-        emptyNode->depthOfNode = this->depthOfNode + 1;
-        emptyNode->children.clear();
-        emptyNode->leftOrRight = 0;
-        this->children.push_back(emptyNode);
+    const BBox &left = this->children[0]->bBox;
+    const BBox &right = this->children[1]->bBox;
+    glm::vec3 overlapMin = glm::max(left.getMin(), right.getMin());
+    glm::vec3 overlapMax = glm::min(left.getMax(), right.getMax());
 
-        BvhNode *emptyNode2 = new BvhNode();
-        *emptyNode2=*emptyNode;
-        emptyNode2->leftOrRight = 1;
-        this->children.push_back(emptyNode2);
+    float overlap = 0;
+    if (glm::all(glm::lessThanEqual(overlapMin, overlapMax))) {
+        overlap = BBox::getSurfaceArea(overlapMin, overlapMax);
     }
+    return overlap + this->children[0]->accumulateSiblingOverlap() +
+           this->children[1]->accumulateSiblingOverlap();
+}
 
-    for (int i = 0; i < this->children.size(); i++) {
-        children.at(i)->treeComplete(deepestLev);
+float BvhNode::getSiblingOverlap() const {
+    float rootArea = this->bBox.getSurfaceArea();
+    if (rootArea <= 0) {
+        return 0;
     }
+    return accumulateSiblingOverlap() / rootArea;
 }
 
-void BvhNode::makeBvHTreeComplete() {
-    int deep = this->getDeepestLevel();
-    this->treeComplete(deep);
+void BvhNode::traceForStatistics(const Ray &ray, const vector<glm::uvec3> &triangles,
+                                 const vector<int> &triangleIndices, float &closestT, int &visitedNodes,
+                                 int &testedTriangles) const {
+    float entryT;
+    visitedNodes++;
+    if (rayIntersectWithBox(this->bBox.getMin(), this->bBox.getMax(), ray, closestT, entryT)) {
+        traverseForStatistics(ray, triangles, triangleIndices, closestT, visitedNodes, testedTriangles);
+    }
 }
 
-int BvhNode::getNumberOfNodes() {
-    numberOf = 1;
-    return countNodes();
-}
+void BvhNode::traverseForStatistics(const Ray &ray, const vector<glm::uvec3> &triangles,
+                                    const vector<int> &triangleIndices, float &closestT, int &visitedNodes,
+                                    int &testedTriangles) const {
+    if (this->isLeaf) {
+        const vector<glm::vec4> &coordinates = BBox::getPrimitiveCoordinates();
+        for (int i = this->firstIndex; i < this->firstIndex + this->indexCount; i++) {
+            const glm::uvec3 &triangle = triangles[triangleIndices[i]];
+            testedTriangles++;
+            float t = rayTriangleIntersect(ray, coordinates.at(triangle.x), coordinates.at(triangle.y),
+                                           coordinates.at(triangle.z));
+            if (t > 0 && t < closestT) {
+                closestT = t;
+            }
+        }
+        return;
+    }
 
-void BvhNode::InfoAboutNode() {
-    numberOfLeaves = 0;
+    // Both boxes are tested, then the nearer child is traversed first so its hits can cull the farther one.
+    float entryT[2];
+    bool hit[2];
+    for (int i = 0; i < 2; i++) {
+        visitedNodes++;
+        const BBox &childBox = this->children[i]->bBox;
+        hit[i] = rayIntersectWithBox(childBox.getMin(), childBox.getMax(), ray, closestT, entryT[i]);
+    }
 
-    cout << "Info about the tree:" << endl;
-    cout << "------------------- " << endl;
-    if (this->isLeaf) {
-        cout << "Number Of leaves: " << 1 << endl;
-    } else {
-        cout << "Number Of leaves: " << getNumberOfLeaves() << endl;
+    int first = entryT[1] < entryT[0] ? 1 : 0;
+    for (int i : {first, 1 - first}) {
+        if (hit[i] && entryT[i] <= closestT) {
+            this->children[i]->traverseForStatistics(ray, triangles, triangleIndices, closestT, visitedNodes,
+                                                     testedTriangles);
+        }
     }
-    cout << "Number Of nodes: " << getNumberOfNodes() << endl;
-    cout << "Deepest level of the tree: " << getDeepestLevel() << "\n" << endl;
 }
 
 const BBox &BvhNode::getBBox() const {
@@ -250,12 +474,13 @@ void BvhNode::setDepthOfNode(int depthOfNode) {
     BvhNode::depthOfNode = depthOfNode;
 }
 
-const vector<BvhNode *> &BvhNode::getChildren() const {
-    return children;
+BvhNode *BvhNode::getChild(int i) const {
+    return children[i];
 }
 
-void BvhNode::setChildren(const vector<BvhNode *> &children) {
-    BvhNode::children = children;
+void BvhNode::setChildren(BvhNode *left, BvhNode *right) {
+    children[0] = left;
+    children[1] = right;
 }
 
 int BvhNode::getOrder() const {
@@ -274,14 +499,6 @@ void BvhNode::setIsLeaf(bool isLeaf) {
     BvhNode::isLeaf = isLeaf;
 }
 
-bool BvhNode::isCreatedEmpty() const {
-    return createdEmpty;
-}
-
-void BvhNode::setCreatedEmpty(bool createdEmpty) {
-    BvhNode::createdEmpty = createdEmpty;
-}
-
 int BvhNode::getLeftOrRight() const {
     return leftOrRight;
 }
@@ -290,12 +507,20 @@ void BvhNode::setLeftOrRight(int leftOrRight) {
     BvhNode::leftOrRight = leftOrRight;
 }
 
-const vector<glm::vec4> &BvhNode::getIndices() const {
-    return indices;
+int BvhNode::getFirstIndex() const {
+    return firstIndex;
+}
+
+void BvhNode::setFirstIndex(int firstIndex) {
+    BvhNode::firstIndex = firstIndex;
+}
+
+int BvhNode::getIndexCount() const {
+    return indexCount;
 }
 
-void BvhNode::setIndices(const vector<glm::vec4> &indices) {
-    BvhNode::indices = indices;
+void BvhNode::setIndexCount(int indexCount) {
+    BvhNode::indexCount = indexCount;
 }
 
 const int &BvhNode::getNumberOfPolygonsInModel() {
@@ -0,0 +1,65 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <new>
+
+#include "../includes/bvhnodearena.h"
+#include "../includes/bvhnode.h"
+
+BvhNodeArena::BvhNodeArena(size_t blockSize)
+        : blockSize(blockSize),
+          usedInBlock(0),
+          capacityOfBlock(0),
+          allocatedNodes(0),
+          reservedNodes(0) {
+}
+
+BvhNodeArena::~BvhNodeArena() {
+    release();
+}
+
+BvhNode *BvhNodeArena::allocate(int count) {
+    lock_guard<mutex> lock(allocationMutex);
+    if (usedInBlock + count > capacityOfBlock) {
+        capacityOfBlock = MAX(blockSize, size_t(count));
+        blocks.emplace_back(new char[capacityOfBlock * sizeof(BvhNode)]);
+        reservedNodes += capacityOfBlock;
+        usedInBlock = 0;
+    }
+    // The nodes are constructed when they are handed out, the untouched rest of a reserved block costs no memory.
+    BvhNode *nodes = reinterpret_cast<BvhNode *>(blocks.back().get()) + usedInBlock;
+    for (int i = 0; i < count; i++) {
+        new(nodes + i) BvhNode();
+    }
+    usedInBlock += count;
+    allocatedNodes += count;
+    return nodes;
+}
+
+void BvhNodeArena::reserve(size_t count) {
+    lock_guard<mutex> lock(allocationMutex);
+    if (usedInBlock + count > capacityOfBlock) {
+        capacityOfBlock = MAX(blockSize, count);
+        blocks.emplace_back(new char[capacityOfBlock * sizeof(BvhNode)]);
+        reservedNodes += capacityOfBlock;
+        usedInBlock = 0;
+    }
+}
+
+void BvhNodeArena::release() {
+    lock_guard<mutex> lock(allocationMutex);
+    blocks.clear();
+    usedInBlock = 0;
+    capacityOfBlock = 0;
+    allocatedNodes = 0;
+    reservedNodes = 0;
+}
+
+size_t BvhNodeArena::getAllocatedNodes() const {
+    return allocatedNodes;
+}
+
+size_t BvhNodeArena::getReservedBytes() const {
+    return reservedNodes * sizeof(BvhNode);
+}
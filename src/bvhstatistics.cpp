@@ -0,0 +1,190 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <iomanip>
+
+#include "../includes/bvhstatistics.h"
+
+BvhStatistics::BvhStatistics()
+        : buildTime(0),
+          nodeCount(0),
+          leafCount(0),
+          emptyLeafCount(0),
+          deepestLevel(0),
+          triangleReferences(0),
+          triangleCount(0),
+          sahCost(0),
+          siblingOverlap(0),
+          nodesPerRay(0),
+          trianglesPerRay(0) {
+}
+
+BvhStatistics BvhStatistics::collect(const BvhNode &root, const BvhSettings &settings, int triangleCount,
+                                     double buildTime) {
+    BvhStatistics statistics;
+    statistics.builderName = settings.getBuilderName();
+    statistics.buildTime = buildTime;
+    statistics.triangleCount = triangleCount;
+
+    // The surfaces are summed over the walk and divided by the surface of the root at the end.
+    double sahSum = 0;
+    double overlapSum = 0;
+    vector<const BvhNode *> stack = {&root};
+    while (!stack.empty()) {
+        const BvhNode *node = stack.back();
+        stack.pop_back();
+        statistics.nodeCount++;
+
+        float area = node->getBBox().getSurfaceArea();
+        int depth = node->getDepthOfNode() - root.getDepthOfNode();
+        statistics.deepestLevel = MAX(statistics.deepestLevel, depth);
+
+        if (node->getIsLeaf()) {
+            int size = node->getIndexCount();
+            sahSum += area * settings.intersectionCost * size;
+            statistics.leafCount++;
+            statistics.emptyLeafCount += size == 0;
+            statistics.triangleReferences += size;
+            if (statistics.leafSizeHistogram.size() <= size) {
+                statistics.leafSizeHistogram.resize(size + 1, 0);
+            }
+            statistics.leafSizeHistogram[size]++;
+            if (statistics.leafDepthHistogram.size() <= depth) {
+                statistics.leafDepthHistogram.resize(depth + 1, 0);
+            }
+            statistics.leafDepthHistogram[depth]++;
+            continue;
+        }
+
+        sahSum += area * settings.traversalCost;
+        const BBox &left = node->getChild(0)->getBBox();
+        const BBox &right = node->getChild(1)->getBBox();
+        glm::vec3 overlapMin = glm::max(left.getMin(), right.getMin());
+        glm::vec3 overlapMax = glm::min(left.getMax(), right.getMax());
+        if (glm::all(glm::lessThanEqual(overlapMin, overlapMax))) {
+            overlapSum += BBox::getSurfaceArea(overlapMin, overlapMax);
+        }
+        stack.push_back(node->getChild(0));
+        stack.push_back(node->getChild(1));
+    }
+
+    float rootArea = root.getBBox().getSurfaceArea();
+    if (rootArea > 0) {
+        statistics.sahCost = float(sahSum / rootArea);
+        statistics.siblingOverlap = float(overlapSum / rootArea);
+    }
+
+    statistics.footprints.push_back({"build nodes", size_t(statistics.nodeCount),
+                                     statistics.nodeCount * sizeof(BvhNode), size_t(statistics.emptyLeafCount)});
+    statistics.footprints.push_back({"triangle records", size_t(statistics.triangleReferences),
+                                     statistics.triangleReferences * sizeof(TriangleRecord), 0});
+    return statistics;
+}
+
+void BvhStatistics::addFootprint(const string &name, size_t nodeCount, size_t nodeSize, size_t emptySlots) {
+    footprints.push_back({name, nodeCount, nodeCount * nodeSize, emptySlots});
+}
+
+void BvhStatistics::setTraversalCost(float nodesPerRay, float trianglesPerRay) {
+    BvhStatistics::nodesPerRay = nodesPerRay;
+    BvhStatistics::trianglesPerRay = trianglesPerRay;
+}
+
+void BvhStatistics::print(ostream &out, StatisticsFormat format) const {
+    if (format == StatisticsFormat::Json) {
+        printJson(out);
+    } else {
+        printText(out);
+    }
+}
+
+void BvhStatistics::printText(ostream &out) const {
+    out << "Info about the tree:" << endl;
+    out << "------------------- " << endl;
+    out << "Builder: " << builderName << ", build time: " << buildTime << " ms" << endl;
+    out << "Number of nodes: " << nodeCount << ", leaves: " << leafCount << ", empty leaves: " << emptyLeafCount
+        << endl;
+    out << "Deepest level of the tree: " << deepestLevel << endl;
+    out << "Triangle references: " << triangleReferences << " for " << triangleCount << " triangles" << endl;
+    out << "SAH cost of the tree: " << sahCost << endl;
+    out << "Sibling overlap: " << siblingOverlap << endl;
+    out << "Visited nodes per primary ray: " << nodesPerRay << ", tested triangles per primary ray: "
+        << trianglesPerRay << endl;
+
+    // The bars are scaled to the largest bucket of the histogram.
+    auto printHistogram = [&](const char *title, const char *label, const vector<int> &histogram) {
+        out << title << endl;
+        int largest = 1;
+        for (int count : histogram) {
+            largest = MAX(largest, count);
+        }
+        for (int i = 0; i < histogram.size(); i++) {
+            if (histogram[i] == 0) {
+                continue;
+            }
+            out << "  " << label << " " << setw(3) << i << ": " << setw(8) << histogram[i] << " "
+                << string(MAX(1, 40 * histogram[i] / largest), '#') << endl;
+        }
+    };
+    printHistogram("Leaf sizes:", "triangles", leafSizeHistogram);
+    printHistogram("Leaf depths:", "depth", leafDepthHistogram);
+
+    out << "Memory:" << endl;
+    for (const Footprint &footprint : footprints) {
+        out << "  " << footprint.name << ": " << footprint.nodeCount << " elements, " << footprint.bytes / 1024
+            << " KB";
+        if (footprint.emptySlots > 0) {
+            out << ", " << footprint.emptySlots << " empty";
+        }
+        out << endl;
+    }
+    out << endl;
+}
+
+void BvhStatistics::printJson(ostream &out) const {
+    auto printArray = [&](const vector<int> &values) {
+        out << "[";
+        for (int i = 0; i < values.size(); i++) {
+            out << (i > 0 ? ", " : "") << values[i];
+        }
+        out << "]";
+    };
+
+    out << "{" << endl;
+    out << "  \"builder\": \"" << builderName << "\"," << endl;
+    out << "  \"buildTimeMs\": " << buildTime << "," << endl;
+    out << "  \"nodes\": " << nodeCount << "," << endl;
+    out << "  \"leaves\": " << leafCount << "," << endl;
+    out << "  \"emptyLeaves\": " << emptyLeafCount << "," << endl;
+    out << "  \"deepestLevel\": " << deepestLevel << "," << endl;
+    out << "  \"triangles\": " << triangleCount << "," << endl;
+    out << "  \"triangleReferences\": " << triangleReferences << "," << endl;
+    out << "  \"sahCost\": " << sahCost << "," << endl;
+    out << "  \"siblingOverlap\": " << siblingOverlap << "," << endl;
+    out << "  \"nodesPerRay\": " << nodesPerRay << "," << endl;
+    out << "  \"trianglesPerRay\": " << trianglesPerRay << "," << endl;
+    out << "  \"leafSizeHistogram\": ";
+    printArray(leafSizeHistogram);
+    out << "," << endl;
+    out << "  \"leafDepthHistogram\": ";
+    printArray(leafDepthHistogram);
+    out << "," << endl;
+    out << "  \"memory\": [";
+    for (int i = 0; i < footprints.size(); i++) {
+        const Footprint &footprint = footprints[i];
+        out << (i > 0 ? "," : "") << endl << "    {\"name\": \"" << footprint.name << "\", \"elements\": "
+            << footprint.nodeCount << ", \"bytes\": " << footprint.bytes << ", \"empty\": " << footprint.emptySlots
+            << "}";
+    }
+    out << endl << "  ]" << endl;
+    out << "}" << endl;
+}
+
+float BvhStatistics::getSahCost() const {
+    return sahCost;
+}
+
+float BvhStatistics::getSiblingOverlap() const {
+    return siblingOverlap;
+}
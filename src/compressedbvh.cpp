@@ -0,0 +1,126 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "../includes/compressedbvh.h"
+
+vector<CompressedBvhNode> CompressedBvh::compress(const vector<WideBvhNode<4>> &wideNodes) {
+    vector<CompressedBvhNode> nodes;
+    nodes.reserve(wideNodes.size());
+    for (const WideBvhNode<4> &wideNode : wideNodes) {
+        for (int i = 0; i < 4; i++) {
+            if (wideNode.count[i] > INT16_MAX) {
+                cout << "A leaf has " << wideNode.count[i] << " triangles, more than a compressed node can hold."
+                     << endl;
+                return vector<CompressedBvhNode>();
+            }
+        }
+        nodes.push_back(compressNode(wideNode));
+    }
+    return nodes;
+}
+
+// 2^exponent built from its bits, like the shader does it. The exponent is at least -126, so the float is normal.
+static float exponentToScale(int exponent) {
+    uint32_t bits = uint32_t(exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+int CompressedBvh::findExponent(float low, float high) {
+    float extent = high - low;
+    int exponent = -126;
+    if (extent > 0) {
+        frexp(extent / 255.0f, &exponent);
+        exponent = glm::max(exponent, -126);
+    }
+    // The division and the float addition of the decoding can round, the largest offset has to reach 'high'.
+    while (exponent < 127 && low + 255.0f * exponentToScale(exponent) < high) {
+        exponent++;
+    }
+    return exponent;
+}
+
+uint8_t CompressedBvh::quantizeMin(float value, float origin, float scale) {
+    int q = glm::clamp(int(floor((value - origin) / scale)), 0, 255);
+    while (q > 0 && origin + float(q) * scale > value) {
+        q--;
+    }
+    return uint8_t(q);
+}
+
+uint8_t CompressedBvh::quantizeMax(float value, float origin, float scale) {
+    int q = glm::clamp(int(ceil((value - origin) / scale)), 0, 255);
+    while (q < 255 && origin + float(q) * scale < value) {
+        q++;
+    }
+    return uint8_t(q);
+}
+
+CompressedBvhNode CompressedBvh::compressNode(const WideBvhNode<4> &wideNode) {
+    glm::vec3 frameMin(99999, 99999, 99999);
+    glm::vec3 frameMax(-99999, -99999, -99999);
+    for (int i = 0; i < 4; i++) {
+        if (wideNode.count[i] < 0) {
+            continue;
+        }
+        frameMin = glm::min(frameMin, glm::vec3(wideNode.minX[i], wideNode.minY[i], wideNode.minZ[i]));
+        frameMax = glm::max(frameMax, glm::vec3(wideNode.maxX[i], wideNode.maxY[i], wideNode.maxZ[i]));
+    }
+
+    CompressedBvhNode node = {};
+    node.originX = frameMin.x;
+    node.originY = frameMin.y;
+    node.originZ = frameMin.z;
+    node.exponentX = int8_t(findExponent(frameMin.x, frameMax.x));
+    node.exponentY = int8_t(findExponent(frameMin.y, frameMax.y));
+    node.exponentZ = int8_t(findExponent(frameMin.z, frameMax.z));
+
+    glm::vec3 scale(exponentToScale(node.exponentX), exponentToScale(node.exponentY), exponentToScale(node.exponentZ));
+    for (int i = 0; i < 4; i++) {
+        node.child[i] = wideNode.child[i];
+        node.count[i] = int16_t(wideNode.count[i]);
+        if (wideNode.count[i] < 0) {
+            continue;
+        }
+        node.qMinX[i] = quantizeMin(wideNode.minX[i], frameMin.x, scale.x);
+        node.qMinY[i] = quantizeMin(wideNode.minY[i], frameMin.y, scale.y);
+        node.qMinZ[i] = quantizeMin(wideNode.minZ[i], frameMin.z, scale.z);
+        node.qMaxX[i] = quantizeMax(wideNode.maxX[i], frameMin.x, scale.x);
+        node.qMaxY[i] = quantizeMax(wideNode.maxY[i], frameMin.y, scale.y);
+        node.qMaxZ[i] = quantizeMax(wideNode.maxZ[i], frameMin.z, scale.z);
+    }
+    return node;
+}
+
+WideBvhNode<4> CompressedBvh::decode(const CompressedBvhNode &node) {
+    float scaleX = exponentToScale(node.exponentX);
+    float scaleY = exponentToScale(node.exponentY);
+    float scaleZ = exponentToScale(node.exponentZ);
+
+    // The same expression as in the quantization, so the decoded boxes are the checked ones.
+    WideBvhNode<4> wideNode;
+    for (int i = 0; i < 4; i++) {
+        wideNode.minX[i] = node.originX + float(node.qMinX[i]) * scaleX;
+        wideNode.minY[i] = node.originY + float(node.qMinY[i]) * scaleY;
+        wideNode.minZ[i] = node.originZ + float(node.qMinZ[i]) * scaleZ;
+        wideNode.maxX[i] = node.originX + float(node.qMaxX[i]) * scaleX;
+        wideNode.maxY[i] = node.originY + float(node.qMaxY[i]) * scaleY;
+        wideNode.maxZ[i] = node.originZ + float(node.qMaxZ[i]) * scaleZ;
+        wideNode.child[i] = node.child[i];
+        wideNode.count[i] = node.count[i];
+    }
+    return wideNode;
+}
+
+void CompressedBvh::traceForStatistics(const vector<CompressedBvhNode> &nodes,
+                                       const vector<TriangleRecord> &leafRecords, const Ray &ray, float &closestT,
+                                       int &visitedNodes, int &testedTriangles) {
+    WideBvh<4>::traverse(leafRecords, ray, closestT, visitedNodes, testedTriangles,
+                         [&](int index) { return decode(nodes[index]); });
+}
@@ -0,0 +1,524 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <iostream>
+
+#include "../includes/cputracer.h"
+#include "../includes/lbvh.h"
+#include "../includes/stb_image.h"
+
+void RayCounters::add(const RayCounters &counters) {
+    rays += counters.rays;
+    shadowRays += counters.shadowRays;
+    occludedShadowRays += counters.occludedShadowRays;
+    shadowNodes += counters.shadowNodes;
+}
+
+static float schlickApprox(float Ni, float cosTheta) {
+    float F0 = pow((1 - Ni) / (1 + Ni), 2);
+    return F0 + (1 - F0) * pow(1 - cosTheta, 5);
+}
+
+CpuTracer::CpuTracer(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                     const vector<unsigned int> &leafMaterials, const vector<Material> &materials, const Light &light,
+                     int blockWidth)
+        : nodes(nodes),
+          leafRecords(leafRecords),
+          leafMaterials(leafMaterials),
+          materials(materials),
+          light(light),
+          textureWidth(0),
+          textureHeight(0),
+          packetWidth(RayPacket::getWidth()),
+          triangleBlocks(blockWidth > 0 ? TriangleBlocks(nodes, leafRecords, blockWidth) : TriangleBlocks()) {
+}
+
+bool CpuTracer::loadTexture(const string &path) {
+    int width, height, nrChannels;
+    stbi_set_flip_vertically_on_load(true);
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrChannels, 3);
+    if (!data) {
+        cout << "ERROR: FAILED to load texture: " << path << endl;
+        return false;
+    }
+    texture.assign(data, data + width * height * 3);
+    textureWidth = width;
+    textureHeight = height;
+    stbi_image_free(data);
+    return true;
+}
+
+void CpuTracer::setPacketWidth(int packetWidth) {
+    CpuTracer::packetWidth = packetWidth;
+}
+
+glm::vec3 CpuTracer::sampleTexture(float u, float v) const {
+    // An incomplete texture samples as black in the shader.
+    if (texture.empty()) {
+        return glm::vec3(0, 0, 0);
+    }
+
+    float x = u * textureWidth - 0.5f;
+    float y = v * textureHeight - 0.5f;
+    int x0 = int(floor(x));
+    int y0 = int(floor(y));
+    float fx = x - x0;
+    float fy = y - y0;
+
+    auto texel = [&](int tx, int ty) {
+        tx = (tx % textureWidth + textureWidth) % textureWidth;
+        ty = (ty % textureHeight + textureHeight) % textureHeight;
+        const unsigned char *rgb = &texture[3 * (ty * textureWidth + tx)];
+        return glm::vec3(rgb[0], rgb[1], rgb[2]) / 255.0f;
+    };
+    glm::vec3 bottom = glm::mix(texel(x0, y0), texel(x0 + 1, y0), fx);
+    glm::vec3 top = glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), fx);
+    return glm::mix(bottom, top, fy);
+}
+
+CpuHit CpuTracer::traverseBvhTree(const Ray &ray) const {
+    float closestT = 3.402823466e+38f;
+    int closestTriangle = -1;
+    traceSingle(ray, closestT, closestTriangle);
+    return getHit(ray, closestT, closestTriangle);
+}
+
+void CpuTracer::traceSingle(const Ray &ray, float &closestT, int &triangle) const {
+    if (triangleBlocks.getBlockWidth() > 0) {
+        triangleBlocks.trace(nodes, ray, 0, closestT, triangle);
+    } else {
+        RayPacket::traceSingle(nodes, leafRecords, ray, 0, closestT, triangle);
+    }
+}
+
+bool CpuTracer::isOccluded(const Ray &shadowRay, long &visitedNodes) const {
+    if (triangleBlocks.getBlockWidth() > 0) {
+        return triangleBlocks.isOccluded(nodes, shadowRay, 0, visitedNodes);
+    }
+    return RayPacket::isOccluded(nodes, leafRecords, shadowRay, 0, visitedNodes);
+}
+
+bool CpuTracer::isOccluded(const Ray &shadowRay, RayCounters &counters) const {
+    bool occluded = isOccluded(shadowRay, counters.shadowNodes);
+    counters.rays++;
+    counters.shadowRays++;
+    counters.occludedShadowRays += occluded;
+    return occluded;
+}
+
+CpuHit CpuTracer::getHit(const Ray &ray, float t, int triangle) const {
+    CpuHit hit;
+    hit.t = -1;
+    if (triangle == -1) {
+        return hit;
+    }
+
+    const TriangleRecord &record = leafRecords[triangle];
+    glm::vec2 barycentrics = record.getBarycentrics(ray);
+    hit.t = t;
+    hit.u = barycentrics.x;
+    hit.v = barycentrics.y;
+    hit.triangle = triangle;
+    hit.orig = ray.orig + glm::normalize(ray.dir) * t;
+    hit.normal = record.getNormal();
+    hit.mat = int(leafMaterials[triangle]);
+    return hit;
+}
+
+glm::vec3 CpuTracer::trace(const Ray &ray, RayCounters &counters) const {
+    return trace(ray, traverseBvhTree(ray), counters);
+}
+
+glm::vec3 CpuTracer::trace(Ray ray, CpuHit hit, RayCounters &counters) const {
+    glm::vec3 weight(1, 1, 1);
+    const float epsilon = 0.0001f;
+    glm::vec3 color(0, 0, 0);
+
+    int tracingDepth = 5;
+
+    for (int i = 0; i < tracingDepth; i++) {
+        if (i > 0) {
+            hit = traverseBvhTree(ray);
+        }
+        counters.rays++;
+        if (hit.t < 0) {
+            return weight * light.La;
+        }
+
+        const Material &material = materials[hit.mat];
+        glm::vec3 textColor = sampleTexture(hit.u, hit.v);
+        Ray shadowRay;
+        shadowRay.orig = hit.orig + hit.normal * epsilon;
+        shadowRay.dir = glm::normalize(light.direction);
+
+        // Ambient light
+        color += glm::vec3(material.Ka) * light.La * textColor * weight;
+
+        // Diffuse light
+        float cosTheta = glm::dot(hit.normal, glm::normalize(light.direction));
+        bool lit = false;
+        if (cosTheta > 0) {
+            lit = !isOccluded(shadowRay, counters);
+        }
+        if (lit) {
+
+            color += light.Le * glm::vec3(material.Kd) * cosTheta * weight;
+
+            glm::vec3 halfVec = glm::normalize(-ray.dir + light.direction);
+            float cosDelta = glm::dot(hit.normal, halfVec);
+
+            // Specular light
+            if (cosDelta > 0) {
+                color += weight * light.Le * glm::vec3(material.Ks) * pow(cosDelta, material.shininess);
+            }
+        }
+
+        if (material.shadingModel == 1) {
+            weight *= schlickApprox(material.Ni, cosTheta);
+            ray.orig = hit.orig + hit.normal * epsilon;
+            ray.dir = glm::reflect(ray.dir, hit.normal);
+        } else {
+            return color;
+        }
+    }
+    return color;
+}
+
+Ray CpuTracer::getPrimaryRay(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                             const glm::vec3 &canvasY, int x, int y, int width, int height) {
+    glm::vec2 normQuadCoord((x + 0.5f) / width * 2 - 1, (y + 0.5f) / height * 2 - 1);
+    glm::vec3 pixel = viewPoint + canvasX * normQuadCoord.x + canvasY * normQuadCoord.y;
+
+    Ray ray;
+    ray.orig = eye;
+    ray.dir = glm::normalize(pixel - eye);
+    return ray;
+}
+
+RayCounters CpuTracer::tracePrimaryRays(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                                        const glm::vec3 &canvasY, int width, int height, int threadCount,
+                                        const function<void(int, const Ray &, const CpuHit &, RayCounters &)> &shade)
+                                        const {
+    const int tileSize = 16;
+    int columnsOfTiles = (width + tileSize - 1) / tileSize;
+    int rowsOfTiles = (height + tileSize - 1) / tileSize;
+    int tileCount = columnsOfTiles * rowsOfTiles;
+
+    // Without packets every pixel is a packet of one ray.
+    int packetColumns = 1;
+    int packetRows = 1;
+    if (packetWidth > 0) {
+        RayPacket::getShape(packetWidth, packetColumns, packetRows);
+    }
+
+    atomic<int> nextTile(0);
+    auto traceTiles = [&]() {
+        RayCounters rayCounters;
+        PacketCounters counters;
+        Ray rays[16];
+        float closestT[16];
+        int triangles[16];
+        int pixels[16];
+        for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+            int beginX = tile % columnsOfTiles * tileSize;
+            int beginY = tile / columnsOfTiles * tileSize;
+            int endX = MIN(beginX + tileSize, width);
+            int endY = MIN(beginY + tileSize, height);
+            for (int packetY = beginY; packetY < endY; packetY += packetRows) {
+                for (int packetX = beginX; packetX < endX; packetX += packetColumns) {
+                    int count = 0;
+                    for (int y = packetY; y < MIN(packetY + packetRows, endY); y++) {
+                        for (int x = packetX; x < MIN(packetX + packetColumns, endX); x++) {
+                            rays[count] = getPrimaryRay(eye, viewPoint, canvasX, canvasY, x, y, width, height);
+                            pixels[count] = y * width + x;
+                            count++;
+                        }
+                    }
+
+                    if (packetWidth > 0) {
+                        RayPacket::trace(packetWidth, nodes, leafRecords, rays, count, closestT, triangles,
+                                         counters);
+                    } else {
+                        closestT[0] = 3.402823466e+38f;
+                        triangles[0] = -1;
+                        traceSingle(rays[0], closestT[0], triangles[0]);
+                    }
+                    for (int r = 0; r < count; r++) {
+                        shade(pixels[r], rays[r], getHit(rays[r], closestT[r], triangles[r]), rayCounters);
+                    }
+                }
+            }
+        }
+        return rayCounters;
+    };
+
+    vector<future<RayCounters>> tasks;
+    for (int t = 1; t < threadCount; t++) {
+        tasks.push_back(async(launch::async, traceTiles));
+    }
+    RayCounters rayCounters = traceTiles();
+    for (future<RayCounters> &task : tasks) {
+        rayCounters.add(task.get());
+    }
+    return rayCounters;
+}
+
+RayCounters CpuTracer::render(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                              const glm::vec3 &canvasY, int width, int height, int threadCount,
+                              vector<glm::vec3> &image) const {
+    image.assign(size_t(width) * height, glm::vec3(0, 0, 0));
+    return tracePrimaryRays(eye, viewPoint, canvasX, canvasY, width, height, threadCount,
+                            [&](int pixel, const Ray &ray, const CpuHit &hit, RayCounters &counters) {
+                                image[pixel] = trace(ray, hit, counters);
+                            });
+}
+
+/* Calls process(begin, end, counters) for the chunks of 'count' items on 'threadCount' threads, the threads take the
+ * next chunk until none is left. Returns the sum of the rays the threads counted.
+ */
+static RayCounters processChunks(int count, int threadCount, const function<void(int, int, RayCounters &)> &process) {
+    const int chunkSize = 256;
+    atomic<int> nextChunk(0);
+    auto processAll = [&]() {
+        RayCounters counters;
+        for (int begin = nextChunk++ * chunkSize; begin < count; begin = nextChunk++ * chunkSize) {
+            process(begin, MIN(begin + chunkSize, count), counters);
+        }
+        return counters;
+    };
+
+    vector<future<RayCounters>> tasks;
+    for (int t = 1; t < threadCount && t * chunkSize < count; t++) {
+        tasks.push_back(async(launch::async, processAll));
+    }
+    RayCounters counters = processAll();
+    for (future<RayCounters> &task : tasks) {
+        counters.add(task.get());
+    }
+    return counters;
+}
+
+vector<int> CpuTracer::getRayOrder(const vector<Ray> &rays, int threadCount) const {
+    // The origins are on the surfaces of the scene, a 512^3 grid is laid over the box of the root. With the octant the
+    // keys have 30 bits, four passes of the radix sort.
+    const float cells = 511;
+    glm::vec3 sceneMin = nodes[0].getMin();
+    glm::vec3 extent = nodes[0].getMax() - sceneMin;
+    glm::vec3 scale(extent.x > 0 ? cells / extent.x : 0, extent.y > 0 ? cells / extent.y : 0,
+                    extent.z > 0 ? cells / extent.z : 0);
+
+    vector<uint64_t> keys(rays.size());
+    vector<int> order(rays.size());
+    for (int r = 0; r < rays.size(); r++) {
+        glm::vec3 cell = glm::clamp((rays[r].orig - sceneMin) * scale, 0.0f, cells);
+        uint64_t octant = uint64_t(rays[r].dir.x < 0) << 2 | uint64_t(rays[r].dir.y < 0) << 1 |
+                          uint64_t(rays[r].dir.z < 0);
+        keys[r] = octant << 27 | Lbvh::expandBits(uint64_t(cell.x)) << 2 | Lbvh::expandBits(uint64_t(cell.y)) << 1 |
+                  Lbvh::expandBits(uint64_t(cell.z));
+        order[r] = r;
+    }
+    Lbvh::radixSort(keys, order, 30, threadCount);
+    return order;
+}
+
+RayCounters CpuTracer::renderWavefront(const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                                       const glm::vec3 &canvasY, int width, int height, int threadCount,
+                                       bool sortRays, vector<glm::vec3> &image, WavefrontTimes &times) const {
+    const float epsilon = 0.0001f;
+    const int tracingDepth = 5;
+    int pixelCount = width * height;
+    image.assign(size_t(pixelCount), glm::vec3(0, 0, 0));
+
+    // The state of trace() for every pixel: the ray of the bounce, its hit and the weight of its colour.
+    vector<Ray> pathRays(pixelCount);
+    vector<CpuHit> pathHits(pixelCount);
+    vector<glm::vec3> weights(pixelCount, glm::vec3(1, 1, 1));
+    // The light a shadow ray brings if it is not blocked, the diffuse and the specular term are added in this order.
+    vector<glm::vec3> diffuseLight(pixelCount);
+    vector<glm::vec3> specularLight(pixelCount);
+
+    tracePrimaryRays(eye, viewPoint, canvasX, canvasY, width, height, threadCount,
+                     [&](int pixel, const Ray &ray, const CpuHit &hit, RayCounters &) {
+                         pathRays[pixel] = ray;
+                         pathHits[pixel] = hit;
+                     });
+    vector<int> paths(pixelCount);
+    for (int p = 0; p < pixelCount; p++) {
+        paths[p] = p;
+    }
+
+    glm::vec3 lightDirection = glm::normalize(light.direction);
+    RayCounters rayCounters;
+    for (int i = 0; i < tracingDepth && !paths.empty(); i++) {
+        // Shading of the hits, it collects the shadow rays and the reflected rays of the bounce.
+        vector<char> casts(paths.size());
+        vector<char> reflects(paths.size());
+        rayCounters.add(processChunks(paths.size(), threadCount, [&](int begin, int end, RayCounters &chunkCounters) {
+            for (int k = begin; k < end; k++) {
+                int p = paths[k];
+                const CpuHit &hit = pathHits[p];
+                Ray &ray = pathRays[p];
+                glm::vec3 &weight = weights[p];
+                chunkCounters.rays++;
+                if (hit.t < 0) {
+                    image[p] = weight * light.La;
+                    continue;
+                }
+
+                const Material &material = materials[hit.mat];
+                glm::vec3 textColor = sampleTexture(hit.u, hit.v);
+
+                // Ambient light
+                image[p] += glm::vec3(material.Ka) * light.La * textColor * weight;
+
+                // Diffuse and specular light, if the shadow ray gets through.
+                float cosTheta = glm::dot(hit.normal, glm::normalize(light.direction));
+                if (cosTheta > 0) {
+                    casts[k] = 1;
+                    diffuseLight[p] = light.Le * glm::vec3(material.Kd) * cosTheta * weight;
+                    glm::vec3 halfVec = glm::normalize(-ray.dir + light.direction);
+                    float cosDelta = glm::dot(hit.normal, halfVec);
+                    specularLight[p] = glm::vec3(0, 0, 0);
+                    if (cosDelta > 0) {
+                        specularLight[p] =
+                                weight * light.Le * glm::vec3(material.Ks) * pow(cosDelta, material.shininess);
+                    }
+                }
+
+                if (material.shadingModel == 1) {
+                    weight *= schlickApprox(material.Ni, cosTheta);
+                    ray.orig = hit.orig + hit.normal * epsilon;
+                    ray.dir = glm::reflect(ray.dir, hit.normal);
+                    reflects[k] = i + 1 < tracingDepth;
+                }
+            }
+        }));
+
+        vector<int> shadowPaths;
+        vector<int> nextPaths;
+        for (int k = 0; k < paths.size(); k++) {
+            if (casts[k]) {
+                shadowPaths.push_back(paths[k]);
+            }
+            if (reflects[k]) {
+                nextPaths.push_back(paths[k]);
+            }
+        }
+
+        // The shadow rays, then the reflected rays, as streams.
+        for (int stream = 0; stream < 2; stream++) {
+            vector<int> &streamPaths = stream == 0 ? shadowPaths : nextPaths;
+            vector<Ray> rays(streamPaths.size());
+            for (int k = 0; k < streamPaths.size(); k++) {
+                int p = streamPaths[k];
+                if (stream == 0) {
+                    rays[k].orig = pathHits[p].orig + pathHits[p].normal * epsilon;
+                    rays[k].dir = lightDirection;
+                } else {
+                    rays[k] = pathRays[p];
+                }
+            }
+
+            // Unsorted the streams are in the order of the pixels.
+            auto sortStart = chrono::steady_clock::now();
+            if (sortRays) {
+                vector<int> order = getRayOrder(rays, threadCount);
+                vector<Ray> sortedRays(rays.size());
+                vector<int> sortedPaths(rays.size());
+                for (int k = 0; k < rays.size(); k++) {
+                    sortedRays[k] = rays[order[k]];
+                    sortedPaths[k] = streamPaths[order[k]];
+                }
+                rays.swap(sortedRays);
+                streamPaths.swap(sortedPaths);
+            }
+            auto traceStart = chrono::steady_clock::now();
+
+            // Neighbouring rays of the stream are traced as packets, the shadow rays as occlusion queries.
+            int batchSize = MAX(1, packetWidth);
+            auto traceBatches = [&](int begin, int end, RayCounters &chunkCounters) {
+                PacketCounters packetCounters;
+                Ray batch[16];
+                float closestT[16];
+                int triangles[16];
+                bool occluded[16];
+                for (int first = begin; first < end; first += batchSize) {
+                    int count = MIN(batchSize, end - first);
+                    for (int r = 0; r < count; r++) {
+                        batch[r] = rays[first + r];
+                    }
+                    if (packetWidth == 0 && stream == 0) {
+                        occluded[0] = isOccluded(batch[0], packetCounters.fallbackNodes);
+                        packetCounters.occludedRays += occluded[0];
+                    } else if (packetWidth == 0) {
+                        closestT[0] = 3.402823466e+38f;
+                        triangles[0] = -1;
+                        traceSingle(batch[0], closestT[0], triangles[0]);
+                    } else if (stream == 0) {
+                        RayPacket::traceOcclusion(packetWidth, nodes, leafRecords, batch, count, occluded,
+                                                  packetCounters);
+                    } else {
+                        RayPacket::trace(packetWidth, nodes, leafRecords, batch, count, closestT, triangles,
+                                         packetCounters);
+                    }
+                    chunkCounters.rays += count;
+
+                    for (int r = 0; r < count; r++) {
+                        int p = streamPaths[first + r];
+                        if (stream == 1) {
+                            pathHits[p] = getHit(batch[r], closestT[r], triangles[r]);
+                        } else if (!occluded[r]) {
+                            image[p] += diffuseLight[p];
+                            image[p] += specularLight[p];
+                        }
+                    }
+                }
+                if (stream == 0) {
+                    // The nodes of the packets are counted for every ray that was active at them.
+                    chunkCounters.shadowRays += end - begin;
+                    chunkCounters.occludedShadowRays += packetCounters.occludedRays;
+                    chunkCounters.shadowNodes += packetCounters.activeRays + packetCounters.fallbackNodes;
+                }
+            };
+            RayCounters streamCounters = processChunks(rays.size(), threadCount, traceBatches);
+            times.secondaryRays += streamCounters.rays;
+            // The reflected rays are counted by the shading of the next bounce.
+            if (stream == 0) {
+                rayCounters.add(streamCounters);
+            }
+
+            chrono::duration<double> sortTime = traceStart - sortStart;
+            chrono::duration<double> traceTime = chrono::steady_clock::now() - traceStart;
+            times.sortTime += sortTime.count();
+            times.traceTime += traceTime.count();
+        }
+        paths.swap(nextPaths);
+    }
+    return rayCounters;
+}
+
+bool CpuTracer::writePpm(const string &path, int width, int height, const vector<glm::vec3> &image) {
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file) {
+        return false;
+    }
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    vector<unsigned char> row(size_t(width) * 3);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            glm::vec3 color = glm::clamp(image[size_t(y) * width + x], 0.0f, 1.0f);
+            for (int c = 0; c < 3; c++) {
+                row[3 * x + c] = (unsigned char) (color[c] * 255 + 0.5f);
+            }
+        }
+        file.write((const char *) row.data(), row.size());
+    }
+    return bool(file);
+}
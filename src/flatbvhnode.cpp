@@ -3,55 +3,226 @@
 //
 
 #include <vector>
+#include <algorithm>
+#include <future>
 #include "../includes/glm/glm.hpp"
 #include "../includes/bvhnode.h"
 #include "../includes/flatbvhnode.h"
 
 
-FlatBvhNode::FlatBvhNode(glm::vec3 min, glm::vec3 max, float ind, bool isLeaf, bool createdEmpty,
-                         vector<glm::vec4> indices, int leftOrRight) :
+FlatBvhNode::FlatBvhNode(glm::vec3 min, glm::vec3 max, float ind, bool isLeaf, int missLink, int firstIndex,
+                         int indexCount) :
         min(glm::vec4(min.x, min.y, min.z, 1.0f)),
         max(glm::vec4(max.x, max.y, max.z, 1.0f)),
         order(ind),
         isLeaf(isLeaf),
-        createdEmpty(createdEmpty),
-        leftOrRight(leftOrRight) {
+        hitLink(isLeaf ? missLink : int(ind) + 1),
+        missLink(missLink),
+        firstIndex(firstIndex),
+        indexCount(indexCount),
+        padding{0, 0} {
+}
+
+FlatBvhNode FlatBvhNode::nodeConverter(const BvhNode &node, int ind, int missLink) {
+    return FlatBvhNode(node.getBBox().getMin(), node.getBBox().getMax(), ind, node.getIsLeaf(), missLink,
+                       node.getFirstIndex(), node.getIndexCount());
+}
+
+/* The nodes are written in the order they are popped from the stack. The node a ray continues with after missing a
+ * node is the one below it on the stack, whose position is not known yet, so the node waits in a chain of that stack
+ * entry (linked through the miss links) until the entry is written. The tree is only read, every node is converted
+ * once, straight into its place in the output.
+ */
+vector<FlatBvhNode> FlatBvhNode::putNodeIntoArray(const BvhNode &root) {
+    struct PendingNode {
+        const BvhNode *node;
+        int firstWaiting;
+    };
+
+    vector<FlatBvhNode> nodesArray;
+    nodesArray.reserve(root.countSubtreeNodes());
+
+    // A pre-order walk keeps at most one pending sibling per level on the stack.
+    vector<PendingNode> stack;
+    stack.reserve(64);
+    stack.push_back({&root, -1});
+
+    while (!stack.empty()) {
+        PendingNode pending = stack.back();
+        stack.pop_back();
+
+        int ind = nodesArray.size();
+        nodesArray.push_back(FlatBvhNode::nodeConverter(*pending.node, ind, -1));
+
+        for (int waiting = pending.firstWaiting; waiting != -1;) {
+            FlatBvhNode &waitingNode = nodesArray[waiting];
+            waiting = waitingNode.missLink;
+            waitingNode.missLink = ind;
+            if (waitingNode.isLeaf) {
+                waitingNode.hitLink = ind;
+            }
+        }
+
+        if (!stack.empty()) {
+            nodesArray.back().missLink = stack.back().firstWaiting;
+            stack.back().firstWaiting = ind;
+        }
 
-    for (int i = 0; i < indices.size(); i++) {
-        this->indices.at(i) = glm::vec4(indices.at(i).x, indices.at(i).y, indices.at(i).z, indices.at(i).w);
+        if (!pending.node->getIsLeaf()) {
+            stack.push_back({pending.node->getChild(1), -1});
+            stack.push_back({pending.node->getChild(0), -1});
+        }
     }
+    return nodesArray;
+}
+
+void FlatBvhNode::traceForStatistics(const vector<FlatBvhNode> &nodes, const vector<glm::uvec3> &leafTriangles,
+                                     const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles) {
+    const vector<glm::vec4> &coordinates = BBox::getPrimitiveCoordinates();
+    traverse(nodes, ray, closestT, visitedNodes, testedTriangles, [&](int j) {
+        const glm::uvec3 &triangle = leafTriangles[j];
+        return rayTriangleIntersect(ray, coordinates[triangle.x], coordinates[triangle.y], coordinates[triangle.z]);
+    });
+}
+
+void FlatBvhNode::traceForStatistics(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                                     const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles,
+                                     int rootNode) {
+    traverse(nodes, ray, closestT, visitedNodes, testedTriangles, [&](int j) {
+        return leafRecords[j].intersect(ray);
+    }, rootNode);
+}
+
+glm::vec3 FlatBvhNode::getMin() const {
+    return glm::vec3(min);
+}
+
+glm::vec3 FlatBvhNode::getMax() const {
+    return glm::vec3(max);
+}
+
+int FlatBvhNode::getHitLink() const {
+    return hitLink;
 }
 
-FlatBvhNode FlatBvhNode::nodeConverter(BvhNode node, int ind) {
-    return FlatBvhNode(node.getBBox().getMin(), node.getBBox().getMax(), ind, node.getIsLeaf(),
-                       node.isCreatedEmpty(),
-                       node.getIndices(), node.getLeftOrRight());
+int FlatBvhNode::getMissLink() const {
+    return missLink;
 }
 
-vector<FlatBvhNode> *FlatBvhNode::putNodeIntoArray(BvhNode *node) {
+int FlatBvhNode::getFirstIndex() const {
+    return firstIndex;
+}
 
-    deque<BvhNode *> queue;
-    queue.push_back(node);
+int FlatBvhNode::getIndexCount() const {
+    return indexCount;
+}
 
-    vector<FlatBvhNode> *nodesArray = new vector<FlatBvhNode>;
+int FlatBvhNode::getSubtreeEnd(const vector<FlatBvhNode> &nodes, int i) {
+    return nodes[i].missLink == -1 ? int(nodes.size()) : nodes[i].missLink;
+}
 
+bool FlatBvhNode::refitNode(vector<FlatBvhNode> &nodes, int i, const vector<glm::uvec3> &leafTriangles,
+                            const vector<glm::vec4> &coordinates) {
+    FlatBvhNode &node = nodes[i];
+    glm::vec4 newMin(99999, 99999, 99999, 1.0f);
+    glm::vec4 newMax(-99999, -99999, -99999, 1.0f);
 
-    int ind = 0;
-    while (!queue.empty()) {
-        BvhNode * curr=new BvhNode(*queue.front());
-        queue.pop_front();
+    if (node.isLeaf) {
+        for (int j = node.firstIndex; j < node.firstIndex + node.indexCount; j++) {
+            const glm::uvec3 &triangle = leafTriangles[j];
+            for (int k = 0; k < 3; k++) {
+                newMin = glm::min(newMin, coordinates[triangle[k]]);
+                newMax = glm::max(newMax, coordinates[triangle[k]]);
+            }
+        }
+    } else {
+        // The first child is the next node, the second one is where a ray continues after missing the first.
+        const FlatBvhNode &left = nodes[i + 1];
+        const FlatBvhNode &right = nodes[left.missLink];
+        newMin = glm::min(left.min, right.min);
+        newMax = glm::max(left.max, right.max);
+    }
+    newMin.w = 1.0f;
+    newMax.w = 1.0f;
 
-        nodesArray->push_back(FlatBvhNode::nodeConverter(*curr, ind));
+    bool changed = newMin != node.min || newMax != node.max;
+    node.min = newMin;
+    node.max = newMax;
+    return changed;
+}
 
-        if (!curr->getChildren().empty()) {
+void FlatBvhNode::refit(vector<FlatBvhNode> &nodes, const vector<glm::uvec3> &leafTriangles,
+                        const vector<glm::vec4> &coordinates, int taskCount, vector<char> &changedNodes) {
+    changedNodes.assign(nodes.size(), 0);
+    if (nodes.empty()) {
+        return;
+    }
 
-            queue.push_back(curr->getChildren().at(0));
-            queue.push_back(curr->getChildren().at(1));
+    // The largest subtree is split until there is about one for each task, the nodes above them are refitted last.
+    vector<int> subtrees{0};
+    vector<int> topNodes;
+    while (subtrees.size() < taskCount) {
+        auto largest = max_element(subtrees.begin(), subtrees.end(), [&](int a, int b) {
+            return getSubtreeEnd(nodes, a) - a < getSubtreeEnd(nodes, b) - b;
+        });
+        int opened = *largest;
+        if (nodes[opened].isLeaf) {
+            break;
         }
+        topNodes.push_back(opened);
+        *largest = opened + 1;
+        subtrees.push_back(nodes[opened + 1].missLink);
+    }
 
-        ind++;
+    // In the pre-order every child comes after its parent, so a backward pass sees the children first.
+    auto refitSubtree = [&](int root) {
+        for (int i = getSubtreeEnd(nodes, root) - 1; i >= root; i--) {
+            changedNodes[i] = refitNode(nodes, i, leafTriangles, coordinates);
+        }
+    };
+    vector<future<void>> tasks;
+    for (int t = 1; t < subtrees.size(); t++) {
+        tasks.push_back(async(launch::async, refitSubtree, subtrees[t]));
+    }
+    refitSubtree(subtrees[0]);
+    for (future<void> &task : tasks) {
+        task.get();
     }
-    cout << "Flatenning the tree is done." << endl;
 
-    return nodesArray;
-}
\ No newline at end of file
+    sort(topNodes.begin(), topNodes.end());
+    for (int t = topNodes.size() - 1; t >= 0; t--) {
+        changedNodes[topNodes[t]] = refitNode(nodes, topNodes[t], leafTriangles, coordinates);
+    }
+}
+
+vector<pair<int, int>> FlatBvhNode::getDirtyRanges(const vector<char> &changedNodes, int mergeGap) {
+    vector<pair<int, int>> ranges;
+    for (int i = 0; i < changedNodes.size(); i++) {
+        if (!changedNodes[i]) {
+            continue;
+        }
+        if (!ranges.empty() && i - ranges.back().second <= mergeGap) {
+            ranges.back().second = i + 1;
+        } else {
+            ranges.emplace_back(i, i + 1);
+        }
+    }
+    return ranges;
+}
+
+float FlatBvhNode::getSahCost(const vector<FlatBvhNode> &nodes, const BvhSettings &settings) {
+    if (nodes.empty()) {
+        return 0;
+    }
+    float rootArea = BBox::getSurfaceArea(glm::vec3(nodes[0].min), glm::vec3(nodes[0].max));
+    if (rootArea <= 0) {
+        return 0;
+    }
+
+    float cost = 0;
+    for (const FlatBvhNode &node : nodes) {
+        float area = BBox::getSurfaceArea(glm::vec3(node.min), glm::vec3(node.max));
+        cost += node.isLeaf ? area * settings.intersectionCost * node.indexCount : area * settings.traversalCost;
+    }
+    return cost / rootArea;
+}
@@ -0,0 +1,312 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <chrono>
+#include <iostream>
+
+#include "../includes/bvhcache.h"
+#include "../includes/bvhnode.h"
+#include "../includes/camera.h"
+#include "../includes/cputracer.h"
+#include "../includes/filesystem.h"
+#include "../includes/flatbvhnode.h"
+#include "../includes/light.h"
+#include "../includes/model.h"
+#include "../includes/settings.h"
+
+vector<glm::vec4> hiddenPrimitives;
+const vector<glm::vec4> &BBox::primitiveCoordinates(hiddenPrimitives);
+
+int hiddenNumberOfPolygons;
+const int &BvhNode::numberOfPolygonsInModel(hiddenNumberOfPolygons);
+
+int hiddenMaxNumberOfPolyInALeaf;
+int &BvhNode::numberOfPolyInTheLeafWithLargestNumberOfPoly(hiddenMaxNumberOfPolyInALeaf);
+
+/* The scene of the window without the window: the model and its tree come from the BVH cache when it is up to date,
+ * otherwise the model is loaded, the tree is built in the same way and the cache is written, the two share the file.
+ */
+static void loadScene(const Settings &settings, Model &model, vector<FlatBvhNode> &flatNodes,
+                      vector<TriangleRecord> &leafRecords) {
+    auto loadStart = chrono::steady_clock::now();
+    string cachePath = BvhCache::getCachePath(settings.modelPath);
+    uint64_t cacheKey = settings.useBvhCache ? BvhCache::computeKey(settings) : 0;
+
+    BvhCache cache;
+    bool cacheHit = settings.useBvhCache && cache.open(cachePath, cacheKey) &&
+                    cache.readScene(model, flatNodes, leafRecords);
+
+    if (!cacheHit) {
+        model = Model(settings.modelPath);
+        hiddenPrimitives = model.allPositionVertices;
+        hiddenNumberOfPolygons = model.indicesInModel.size();
+
+        BvhNodeArena arena;
+        BvhNode *root = arena.allocate(1);
+        vector<int> triangleIndices = root->buildTree(model.indicesInModel, settings.bvh, arena);
+        model.reorderTriangles(triangleIndices);
+        if (settings.reorderVertices) {
+            model.reorderVertices();
+        }
+        flatNodes = FlatBvhNode::putNodeIntoArray(*root);
+        leafRecords = TriangleRecord::buildRecords(model.indicesInModel, model.allPositionVertices);
+
+        if (settings.useBvhCache) {
+            BvhCache::writeScene(cachePath, cacheKey, model, flatNodes, leafRecords);
+        }
+    }
+
+    chrono::duration<double, milli> loadTime = chrono::steady_clock::now() - loadStart;
+    cout << (cacheHit ? "Scene loaded from the BVH cache in " : "Scene loaded and built in ") << loadTime.count()
+         << " ms: " << model.indicesInModel.size() << " triangles, " << flatNodes.size() << " nodes, "
+         << settings.bvh.getBuilderName() << endl;
+}
+
+/* Traces the primary rays of the image a few times on one thread, one by one and in packets of 8 and 16 rays if the CPU
+ * supports them. The rays of a packet are the pixels of its 4x2 or 4x4 block. A packet ray whose closest triangle is
+ * not the one of the single ray counts as a mismatch.
+ */
+static void benchmarkPackets(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                             const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                             const glm::vec3 &canvasY, int width, int height) {
+    const int repetitions = 5;
+    vector<int> singleTriangles(size_t(width) * height);
+    double singleRate = 0;
+
+    cout << "Primary rays of the " << width << "x" << height << " image on one thread:" << endl;
+    cout << "------------------- " << endl;
+    for (int packetWidth : {0, 8, 16}) {
+        if (packetWidth > RayPacket::getWidth()) {
+            cout << packetWidth << " ray packets are not supported by the CPU." << endl;
+            continue;
+        }
+        int packetColumns = 1;
+        int packetRows = 1;
+        if (packetWidth > 0) {
+            RayPacket::getShape(packetWidth, packetColumns, packetRows);
+        }
+
+        // The rays in the order of the packets, and the pixel of each.
+        vector<Ray> rays;
+        vector<int> pixels;
+        vector<int> packetSizes;
+        for (int packetY = 0; packetY < height; packetY += packetRows) {
+            for (int packetX = 0; packetX < width; packetX += packetColumns) {
+                int count = 0;
+                for (int y = packetY; y < MIN(packetY + packetRows, height); y++) {
+                    for (int x = packetX; x < MIN(packetX + packetColumns, width); x++) {
+                        rays.push_back(CpuTracer::getPrimaryRay(eye, viewPoint, canvasX, canvasY, x, y, width, height));
+                        pixels.push_back(y * width + x);
+                        count++;
+                    }
+                }
+                packetSizes.push_back(count);
+            }
+        }
+
+        vector<float> closestT(rays.size());
+        vector<int> triangles(rays.size());
+        PacketCounters counters;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++) {
+            size_t first = 0;
+            for (int count : packetSizes) {
+                RayPacket::trace(packetWidth, nodes, leafRecords, &rays[first], count, &closestT[first],
+                                 &triangles[first], counters);
+                first += count;
+            }
+        }
+        chrono::duration<double> time = chrono::steady_clock::now() - start;
+        double rate = double(repetitions) * rays.size() / time.count();
+
+        int mismatches = 0;
+        for (int r = 0; r < rays.size(); r++) {
+            if (packetWidth == 0) {
+                singleTriangles[pixels[r]] = triangles[r];
+            } else {
+                mismatches += singleTriangles[pixels[r]] != triangles[r];
+            }
+        }
+        if (packetWidth == 0) {
+            singleRate = rate;
+            cout << "single rays | " << rate / 1e6 << " Mrays/s" << endl;
+        } else {
+            cout << packetWidth << " ray packets | " << rate / 1e6 << " Mrays/s (" << rate / singleRate
+                 << "x) | active rays per node test: " << double(counters.activeRays) / counters.nodeTests
+                 << " | rays finished alone: " << 100.0 * counters.fallbackRays / (double(repetitions) * rays.size())
+                 << "% | mismatches: " << mismatches << endl;
+        }
+    }
+    cout << endl;
+}
+
+/* Tests rays against the triangles of the leaves on one thread, one by one and in blocks of every supported width: the
+ * primary rays of the image through the tree, then a part of them against all triangles of the model in one leaf, the
+ * dense scan where the triangle tests take all of the time. A ray whose closest triangle is not the one of the tests
+ * one by one counts as a mismatch.
+ */
+static void benchmarkTriangleBlocks(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                                    const glm::vec3 &eye, const glm::vec3 &viewPoint, const glm::vec3 &canvasX,
+                                    const glm::vec3 &canvasY, int width, int height) {
+    const int repetitions = 3;
+    vector<Ray> primaryRays;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            primaryRays.push_back(CpuTracer::getPrimaryRay(eye, viewPoint, canvasX, canvasY, x, y, width, height));
+        }
+    }
+
+    // One leaf in the box of the root, scanned by every n-th primary ray, about 3 * 10^7 triangle tests.
+    vector<FlatBvhNode> scanNodes = {FlatBvhNode(nodes[0].getMin(), nodes[0].getMax(), 0, true, -1, 0,
+                                                 leafRecords.size())};
+    int scanRayCount = MIN(primaryRays.size(), MAX(1, 30000000 / leafRecords.size()));
+    vector<Ray> scanRays;
+    for (int k = 0; k < scanRayCount; k++) {
+        scanRays.push_back(primaryRays[k * (primaryRays.size() / scanRayCount)]);
+    }
+
+    for (bool scan : {false, true}) {
+        const vector<FlatBvhNode> &testNodes = scan ? scanNodes : nodes;
+        const vector<Ray> &rays = scan ? scanRays : primaryRays;
+        if (scan) {
+            cout << rays.size() << " rays against all " << leafRecords.size() << " triangles on one thread:" << endl;
+        } else {
+            cout << "Primary rays of the " << width << "x" << height << " image through the tree on one thread:"
+                 << endl;
+        }
+        cout << "------------------- " << endl;
+
+        vector<int> singleTriangles(rays.size());
+        double singleRate = 0;
+        for (int blockWidth : {0, 4, 8, 16}) {
+            if (blockWidth > TriangleBlocks::getWidth()) {
+                cout << blockWidth << " triangle blocks are not supported by the CPU." << endl;
+                continue;
+            }
+            TriangleBlocks blocks;
+            if (blockWidth > 0) {
+                blocks = TriangleBlocks(testNodes, leafRecords, blockWidth);
+            }
+
+            vector<int> triangles(rays.size());
+            auto start = chrono::steady_clock::now();
+            for (int r = 0; r < repetitions; r++) {
+                for (int k = 0; k < rays.size(); k++) {
+                    float closestT = 3.402823466e+38f;
+                    triangles[k] = -1;
+                    if (blockWidth > 0) {
+                        blocks.trace(testNodes, rays[k], 0, closestT, triangles[k]);
+                    } else {
+                        RayPacket::traceSingle(testNodes, leafRecords, rays[k], 0, closestT, triangles[k]);
+                    }
+                }
+            }
+            chrono::duration<double> time = chrono::steady_clock::now() - start;
+            double rate = double(repetitions) * rays.size() / time.count();
+
+            int mismatches = 0;
+            for (int k = 0; k < rays.size(); k++) {
+                if (blockWidth == 0) {
+                    singleTriangles[k] = triangles[k];
+                } else {
+                    mismatches += singleTriangles[k] != triangles[k];
+                }
+            }
+            if (blockWidth == 0) {
+                singleRate = rate;
+                cout << "single triangles | " << rate / 1e6 << " Mrays/s";
+            } else {
+                cout << blockWidth << " triangle blocks | " << rate / 1e6 << " Mrays/s (" << rate / singleRate << "x)";
+            }
+            if (scan) {
+                cout << " | " << rate * leafRecords.size() / 1e6 << " M triangle tests/s";
+            }
+            cout << (blockWidth > 0 ? " | mismatches: " + to_string(mismatches) : "") << endl;
+        }
+        cout << endl;
+    }
+}
+
+/* Renders the model with the tracing of the shader on the CPU, without a window or a GL context, and writes the image
+ * into a PPM file. It takes the options of the window and --width, --height, --render-threads, --output, --no-packets,
+ * --benchmark-packets, --no-triangle-blocks, --benchmark-triangle-blocks, --wavefront and --no-ray-sorting.
+ */
+int main(int argc, char **argv) {
+    Settings settings = Settings::fromArguments(argc, argv);
+    if (settings.instanceCount > 0 || settings.animate || settings.bvh.layout != BvhLayout::Binary) {
+        cout << "The headless renderer traces the binary tree of the model, without instances and animation." << endl;
+    }
+
+    Model model;
+    vector<FlatBvhNode> flatNodes;
+    vector<TriangleRecord> leafRecords;
+    loadScene(settings, model, flatNodes, leafRecords);
+    if (flatNodes.empty()) {
+        cout << "The model " << settings.modelPath << " has no triangles to render." << endl;
+        return -1;
+    }
+
+    // The camera, the light and the canvas of the window, the canvas is stretched to the aspect of the image.
+    Camera camera(45 * (float) M_PI / 180, glm::vec3(0, 2, 24), glm::vec3(0, 1, 0), glm::vec3(0, 0, 0));
+    Light light(glm::vec3(0.7, 0.5, 0.5), glm::vec3(0.7, 0.6, 0.6), glm::vec3(0.7f, 0.7f, 0.7f));
+    glm::vec3 connect = camera.getPosCamera() - camera.getViewPoint();
+    float aspect = (float) settings.imageWidth / (float) settings.imageHeight;
+    float length = tanf(camera.getFieldOfview() / 2);
+    glm::vec3 canvasX = glm::normalize(glm::cross(camera.upVector, connect)) / length / aspect;
+
+    if (settings.benchmarkPackets) {
+        benchmarkPackets(flatNodes, leafRecords, camera.getPosCamera(), camera.getViewPoint(), canvasX,
+                         camera.getUpVector(), settings.imageWidth, settings.imageHeight);
+    }
+
+    if (settings.benchmarkTriangleBlocks) {
+        benchmarkTriangleBlocks(flatNodes, leafRecords, camera.getPosCamera(), camera.getViewPoint(), canvasX,
+                                camera.getUpVector(), settings.imageWidth, settings.imageHeight);
+    }
+
+    int blockWidth = settings.useTriangleBlocks ? TriangleBlocks::chooseWidth(flatNodes) : 0;
+    CpuTracer tracer(flatNodes, leafRecords, model.materialIndicesInModel, model.materials, light, blockWidth);
+    tracer.loadTexture(File::getPath("model/wood.png"));
+    int packetWidth = settings.usePacketTraversal ? RayPacket::getWidth() : 0;
+    tracer.setPacketWidth(packetWidth);
+
+    vector<glm::vec3> image;
+    WavefrontTimes wavefrontTimes;
+    auto renderStart = chrono::steady_clock::now();
+    RayCounters rayCounters;
+    if (settings.wavefront) {
+        rayCounters = tracer.renderWavefront(camera.getPosCamera(), camera.getViewPoint(), canvasX,
+                                             camera.getUpVector(), settings.imageWidth, settings.imageHeight,
+                                             settings.renderThreads, settings.sortRays, image, wavefrontTimes);
+    } else {
+        rayCounters = tracer.render(camera.getPosCamera(), camera.getViewPoint(), canvasX, camera.getUpVector(),
+                                    settings.imageWidth, settings.imageHeight, settings.renderThreads, image);
+    }
+    chrono::duration<double> renderTime = chrono::steady_clock::now() - renderStart;
+
+    cout << "Rendered " << settings.imageWidth << "x" << settings.imageHeight << " pixels on " << settings.renderThreads
+         << " thread(s), " << (packetWidth > 0 ? to_string(packetWidth) + " ray packets" : "single rays") << ", "
+         << (blockWidth > 0 ? to_string(blockWidth) + " triangle blocks" : "single triangles") << ", in "
+         << renderTime.count() * 1000 << " ms: " << rayCounters.rays << " rays, "
+         << rayCounters.rays / renderTime.count() / 1e6 << " Mrays/s" << endl;
+    if (rayCounters.shadowRays > 0) {
+        cout << "Shadow rays: " << rayCounters.shadowRays << ", " << rayCounters.occludedShadowRays << " ("
+             << 100.0 * rayCounters.occludedShadowRays / rayCounters.shadowRays
+             << "%) stopped at the first blocking triangle, "
+             << double(rayCounters.shadowNodes) / rayCounters.shadowRays << " visited nodes per shadow ray" << endl;
+    }
+    if (settings.wavefront) {
+        cout << "Shadow and reflected rays in streams" << (settings.sortRays ? ", sorted in " : ", unsorted")
+             << (settings.sortRays ? to_string(wavefrontTimes.sortTime * 1000) + " ms" : "") << ": "
+             << wavefrontTimes.secondaryRays << " rays traced in " << wavefrontTimes.traceTime * 1000 << " ms, "
+             << wavefrontTimes.secondaryRays / wavefrontTimes.traceTime / 1e6 << " Mrays/s" << endl;
+    }
+
+    if (!CpuTracer::writePpm(settings.imagePath, settings.imageWidth, settings.imageHeight, image)) {
+        cout << "The image could not be written to " << settings.imagePath << endl;
+        return -1;
+    }
+    cout << "The image is written to " << settings.imagePath << endl;
+    return 0;
+}
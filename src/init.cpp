@@ -1,5 +1,7 @@
 #include "../includes/init.h"
 #include <string>
+#include <chrono>
+#include <fstream>
 
 void Init::createQuadShaderProg(const GLchar *VS_Path, const GLchar *FS_Path) {
     shaderQuadVertex = Shader();
@@ -54,29 +56,659 @@ void Init::sendVerticesIndices() {
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
+/* The scene comes from the cache file of the model if it was built from the same files with the same settings,
+ * otherwise the model is loaded, its tree is built and the cache file is written. The cache holds the binary tree, the
+ * wide layouts and the comparisons start from the model.
+ */
+void Init::loadScene() {
+    if (settings.animate && bvhLayout != BvhLayout::Binary) {
+        cout << "The refit of the animation works on the binary layout, it is used instead of the "
+             << BvhSettings::getLayoutName(bvhLayout) << "." << endl;
+        bvhLayout = BvhLayout::Binary;
+    }
+
+    if (settings.instanceCount > 0 && bvhLayout != BvhLayout::Binary) {
+        cout << "The instances are traced through the binary layout, it is used instead of the "
+             << BvhSettings::getLayoutName(bvhLayout) << "." << endl;
+        bvhLayout = BvhLayout::Binary;
+    }
+
+    auto loadStart = chrono::steady_clock::now();
+    bool useCache = settings.useBvhCache && bvhLayout == BvhLayout::Binary && !settings.bvh.compareBuilders &&
+                    !settings.bvh.compareLayouts && !settings.bvh.benchmarkTriangleTests;
+    string cachePath = BvhCache::getCachePath(settings.modelPath);
+    uint64_t cacheKey = useCache ? BvhCache::computeKey(settings) : 0;
+
+    bool cacheHit = useCache && loadBvhTreeFromCache(cachePath, cacheKey);
+    if (!cacheHit) {
+        mymodel = Model(settings.modelPath);
+        buildBvhTree();
+        if (useCache) {
+            saveBvhTreeToCache(cachePath, cacheKey);
+        }
+    }
+
+    chrono::duration<double, milli> loadTime = chrono::steady_clock::now() - loadStart;
+    cout << (cacheHit ? "Scene loaded from the BVH cache in " : "Scene loaded and built in ") << loadTime.count()
+         << " ms\n" << endl;
+}
+
+bool Init::loadBvhTreeFromCache(const string &cachePath, uint64_t cacheKey) {
+    BvhCache cache;
+    if (!cache.open(cachePath, cacheKey)) {
+        return false;
+    }
+    // The sizes of the stored elements are checked, a cache of an older node or record layout is not read.
+    if (!cache.readScene(mymodel, flatNodes, leafRecords)) {
+        cout << "The BVH cache " << cachePath << " has another layout, the tree is rebuilt." << endl;
+        return false;
+    }
+
+    hiddenPrimitives = mymodel.allPositionVertices;
+    hiddenNumberOfPolygons = mymodel.indicesInModel.size();
+    restPositions = mymodel.allPositionVertices;
+    if (settings.animate) {
+        mymodel.getUniqueTriangles(restTriangles, restTriangleMaterials);
+    }
+    builtSahCost = FlatBvhNode::getSahCost(flatNodes, settings.bvh);
+    cout << "BVH cache: " << cachePath << ", " << flatNodes.size() << " nodes, " << mymodel.indicesInModel.size()
+         << " triangles, SAH cost: " << builtSahCost << endl;
+
+    uploadTreeBuffers();
+    if (settings.instanceCount > 0) {
+        placeInstances();
+    }
+    return true;
+}
+
+void Init::saveBvhTreeToCache(const string &cachePath, uint64_t cacheKey) {
+    if (BvhCache::writeScene(cachePath, cacheKey, mymodel, flatNodes, leafRecords)) {
+        cout << "The built scene is stored in " << cachePath << endl;
+    } else {
+        cout << "The BVH cache " << cachePath << " could not be written." << endl;
+    }
+}
+
 void Init::buildBvhTree() {
 
     hiddenPrimitives = mymodel.allPositionVertices;
     hiddenNumberOfPolygons = mymodel.indicesInModel.size();
 
-    bvhNode = new BvhNode();
-    bvhNode->buildTree(mymodel.indicesInModel, 0);
-    bvhNode->makeBvHTreeComplete();
-    bvhNode->InfoAboutNode();
+    if (settings.bvh.compareBuilders) {
+        compareBuilders();
+    }
 
-    vector<FlatBvhNode> *nodeArrays = FlatBvhNode::putNodeIntoArray(bvhNode);
-    delete bvhNode;
+    size_t allocationsBeforeBuild = AllocationCounter::getNumberOfAllocations();
+    auto buildStart = chrono::steady_clock::now();
+    bvhNode = nodeArena.allocate(1);
+    vector<int> triangleIndices = bvhNode->buildTree(mymodel.indicesInModel, settings.bvh, nodeArena);
+    chrono::duration<double, milli> buildTime = chrono::steady_clock::now() - buildStart;
+    size_t allocationsOfBuild = AllocationCounter::getNumberOfAllocations() - allocationsBeforeBuild;
+
+    cout << "BVH builder: " << settings.bvh.getBuilderName() << endl;
+    cout << "Build time: " << buildTime.count() << " ms on " << settings.bvh.buildThreads << " thread(s)" << endl;
+    if (AllocationCounter::isEnabled()) {
+        cout << "Heap allocations during the build: " << allocationsOfBuild << endl;
+    }
+    cout << "Build nodes: " << nodeArena.getAllocatedNodes() << " from the arena, "
+         << nodeArena.getReservedBytes() / 1024 << " KB reserved" << endl;
+    float nodesPerRay, trianglesPerRay;
+    measureTraversal(bvhNode, triangleIndices, nodesPerRay, trianglesPerRay);
+    cout << "Leaf size limit: " << settings.bvh.maxLeafSize << ", depth limit: " << settings.bvh.maxDepth
+         << ", largest leaf: " << BvhNode::getNumberOfPolyInTheLeafWithLargestNumberOfPoly() << " triangles\n" << endl;
+    BvhStatistics statistics = BvhStatistics::collect(*bvhNode, settings.bvh, mymodel.indicesInModel.size(),
+                                                      buildTime.count());
+    statistics.setTraversalCost(nodesPerRay, trianglesPerRay);
+
+    // The leaves are ranges of the triangle index list, so after putting the triangles into that order the list is the
+    // identity. Neighbouring leaves of the depth-first order are next to each other in memory.
+    mymodel.reorderTriangles(triangleIndices);
+    if (settings.reorderVertices) {
+        mymodel.reorderVertices();
+        hiddenPrimitives = mymodel.allPositionVertices;
+    }
+    cout << "Triangles" << (settings.reorderVertices ? " and vertices" : "") << " are in the order of the leaves."
+         << endl;
+    restPositions = mymodel.allPositionVertices;
+    if (settings.animate) {
+        mymodel.getUniqueTriangles(restTriangles, restTriangleMaterials);
+    }
 
-    unsigned int nodesArraytoSendtoShader;
-    glGenBuffers(1, &nodesArraytoSendtoShader);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodesArraytoSendtoShader);
+    auto flattenStart = chrono::steady_clock::now();
+    flatNodes = FlatBvhNode::putNodeIntoArray(*bvhNode);
+    chrono::duration<double, milli> flattenTime = chrono::steady_clock::now() - flattenStart;
+    cout << "Flattening time: " << flattenTime.count() << " ms for " << flatNodes.size() << " nodes" << endl;
+
+    vector<WideBvhNode<4>> wideNodes4;
+    vector<WideBvhNode<8>> wideNodes8;
+    vector<CompressedBvhNode> compressedNodes;
+    if (bvhLayout == BvhLayout::Wide4 || bvhLayout == BvhLayout::Compressed4 || settings.bvh.compareLayouts) {
+        wideNodes4 = WideBvh<4>::collapse(*bvhNode);
+    }
+    if (bvhLayout == BvhLayout::Wide8 || settings.bvh.compareLayouts) {
+        wideNodes8 = WideBvh<8>::collapse(*bvhNode);
+    }
+    if (bvhLayout == BvhLayout::Compressed4 || settings.bvh.compareLayouts) {
+        compressedNodes = CompressedBvh::compress(wideNodes4);
+        if (compressedNodes.empty() && bvhLayout == BvhLayout::Compressed4) {
+            cout << "The uncompressed BVH4 is used instead." << endl;
+            bvhLayout = BvhLayout::Wide4;
+        }
+    }
+    // The stack of the wide traversal in the shader has a fixed size, a tree that could need more is traced binary
+    // instead of losing the children that do not fit.
+    int stackSize = 0;
+    // The compressed nodes have the children of the BVH4 they were made of.
+    if (bvhLayout == BvhLayout::Wide4 || bvhLayout == BvhLayout::Compressed4) {
+        stackSize = WideBvh<4>::getStackSize(wideNodes4);
+    } else if (bvhLayout == BvhLayout::Wide8) {
+        stackSize = WideBvh<8>::getStackSize(wideNodes8);
+    }
+    if (stackSize > WideBvh<4>::shaderStackSize) {
+        cout << "The " << BvhSettings::getLayoutName(bvhLayout) << " can need " << stackSize
+             << " traversal stack entries, the shader has " << WideBvh<4>::shaderStackSize
+             << ". The binary layout is used instead." << endl;
+        bvhLayout = BvhLayout::Binary;
+    }
+    if (bvhLayout != BvhLayout::Binary) {
+        size_t wideNodeCount = bvhLayout == BvhLayout::Wide8 ? wideNodes8.size() : wideNodes4.size();
+        cout << "Collapsed into a " << BvhSettings::getLayoutName(bvhLayout) << ": " << wideNodeCount << " nodes"
+             << endl;
+    }
+    // The build nodes are freed together, the flat and the wide nodes are kept.
+    nodeArena.release();
+    bvhNode = nullptr;
+
+    statistics.addFootprint("binary nodes", flatNodes.size(), sizeof(FlatBvhNode), 0);
+    if (!wideNodes4.empty()) {
+        statistics.addFootprint("BVH4 nodes", wideNodes4.size(), sizeof(WideBvhNode<4>),
+                                BvhStatistics::countEmptySlots(wideNodes4));
+    }
+    if (!wideNodes8.empty()) {
+        statistics.addFootprint("BVH8 nodes", wideNodes8.size(), sizeof(WideBvhNode<8>),
+                                BvhStatistics::countEmptySlots(wideNodes8));
+    }
+    if (!compressedNodes.empty()) {
+        statistics.addFootprint("compressed BVH4 nodes", compressedNodes.size(), sizeof(CompressedBvhNode),
+                                BvhStatistics::countEmptySlots(wideNodes4));
+    }
+    printStatistics(statistics);
+
+    // The leaves point into these buffers. The material is only read for the closest hit, so it is kept apart.
+    const vector<glm::uvec3> &leafTriangles = mymodel.indicesInModel;
+    leafRecords = TriangleRecord::buildRecords(leafTriangles, mymodel.allPositionVertices);
+    builtSahCost = FlatBvhNode::getSahCost(flatNodes, settings.bvh);
+
+    if (settings.bvh.benchmarkTriangleTests) {
+        measureFlatTraversal(flatNodes, leafRecords, nodesPerRay, trianglesPerRay);
+        cout << "Stackless traversal of the flat tree: " << nodesPerRay << " visited nodes per primary ray, "
+             << trianglesPerRay << " tested triangles per primary ray" << endl;
+        benchmarkTriangleTests(flatNodes, leafTriangles, leafRecords);
+    }
+    if (settings.bvh.compareLayouts) {
+        compareLayouts(flatNodes, wideNodes4, wideNodes8, compressedNodes, leafRecords);
+    }
+
+    uploadTreeBuffers();
+    if (settings.instanceCount > 0) {
+        placeInstances();
+    }
+
+    // The shader reads the wide nodes as an array of vec4s, 8 * (width / 4) per node, and the compressed nodes as an
+    // array of uvec4s, 4 per node.
+    if (bvhLayout != BvhLayout::Binary) {
+        const void *wideNodes = wideNodes4.data();
+        size_t wideNodesSize = wideNodes4.size() * sizeof(WideBvhNode<4>);
+        int binding = 5;
+        if (bvhLayout == BvhLayout::Wide8) {
+            wideNodes = wideNodes8.data();
+            wideNodesSize = wideNodes8.size() * sizeof(WideBvhNode<8>);
+        } else if (bvhLayout == BvhLayout::Compressed4) {
+            wideNodes = compressedNodes.data();
+            wideNodesSize = compressedNodes.size() * sizeof(CompressedBvhNode);
+            binding = 6;
+        }
+        cout << "Node buffer of the shader: " << wideNodesSize / 1024 << " KB, "
+             << flatNodes.size() * sizeof(FlatBvhNode) / 1024 << " KB with the binary layout" << endl;
+
+        unsigned int wideNodesToSendToShader;
+        glGenBuffers(1, &wideNodesToSendToShader);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, wideNodesToSendToShader);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, wideNodesSize, wideNodes, GL_STATIC_DRAW);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, wideNodesToSendToShader, 0, wideNodesSize);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+}
+
+// The flat nodes, the triangle records and the materials of the leaves. The animated model rewrites them every frame.
+void Init::uploadTreeBuffers() {
+    GLenum usage = settings.animate ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+    const vector<unsigned int> &leafMaterials = mymodel.materialIndicesInModel;
 
-    glBufferData(GL_SHADER_STORAGE_BUFFER, nodeArrays->size() * sizeof(FlatBvhNode), nodeArrays->data(),
-                 GL_STATIC_DRAW);
+    if (nodesArraytoSendtoShader == 0) {
+        glGenBuffers(1, &nodesArraytoSendtoShader);
+        glGenBuffers(1, &leafRecordsToSendToShader);
+        glGenBuffers(1, &leafMaterialsToSendToShader);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodesArraytoSendtoShader);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, flatNodes.size() * sizeof(FlatBvhNode), flatNodes.data(), usage);
     glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, nodesArraytoSendtoShader, 0,
-                      nodeArrays->size() * sizeof(FlatBvhNode));
+                      flatNodes.size() * sizeof(FlatBvhNode));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, leafRecordsToSendToShader);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, leafRecords.size() * sizeof(TriangleRecord), leafRecords.data(), usage);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, leafRecordsToSendToShader, 0,
+                      leafRecords.size() * sizeof(TriangleRecord));
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, leafMaterialsToSendToShader);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, leafMaterials.size() * sizeof(unsigned int), leafMaterials.data(), usage);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, leafMaterialsToSendToShader, 0,
+                      leafMaterials.size() * sizeof(unsigned int));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// A wave runs up the model, every vertex is moved sideways by a few percent of the height of the model.
+void Init::animateModel(float time) {
+    float bottom = 99999;
+    float top = -99999;
+    for (const glm::vec4 &position : restPositions) {
+        bottom = MIN(bottom, position.y);
+        top = MAX(top, position.y);
+    }
+    float height = MAX(top - bottom, 1e-6f);
+
+    for (int i = 0; i < restPositions.size(); i++) {
+        const glm::vec4 &position = restPositions[i];
+        float phase = 2 * time - (position.y - bottom) / height * 2 * float(M_PI);
+        mymodel.allPositionVertices[i] = position + glm::vec4(0.03f * height * sin(phase), 0, 0, 0);
+    }
+    refitBvhTree();
+}
+
+void Init::refitBvhTree() {
+    auto refitStart = chrono::steady_clock::now();
+    // hiddenPrimitives still has the positions of the previous frame, only the triangles of the moved vertices get new
+    // records.
+    vector<char> movedVertices(mymodel.allPositionVertices.size());
+    for (int i = 0; i < movedVertices.size(); i++) {
+        movedVertices[i] = mymodel.allPositionVertices[i] != hiddenPrimitives[i];
+    }
+    hiddenPrimitives = mymodel.allPositionVertices;
+    vector<char> changedRecords;
+    TriangleRecord::updateRecords(leafRecords, mymodel.indicesInModel, mymodel.allPositionVertices, movedVertices,
+                                  changedRecords);
+
+    vector<char> changedNodes;
+    FlatBvhNode::refit(flatNodes, mymodel.indicesInModel, mymodel.allPositionVertices, settings.bvh.buildThreads,
+                       changedNodes);
+
+    // Refitted boxes grow and overlap, past the threshold a new tree is cheaper to trace than the refitted one.
+    float sahCost = FlatBvhNode::getSahCost(flatNodes, settings.bvh);
+    if (sahCost > builtSahCost * settings.bvh.refitRebuildThreshold) {
+        cout << "SAH cost of the refitted tree: " << sahCost << ", more than " << settings.bvh.refitRebuildThreshold
+             << " times the cost after the build (" << builtSahCost << "), the tree is rebuilt." << endl;
+        rebuildBvhTree();
+        return;
+    }
+
+    // Only the ranges of the changed nodes and records are uploaded, close ranges in one call.
+    int uploadedNodes = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodesArraytoSendtoShader);
+    for (const pair<int, int> &range : FlatBvhNode::getDirtyRanges(changedNodes, 16)) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, range.first * sizeof(FlatBvhNode),
+                        (range.second - range.first) * sizeof(FlatBvhNode), flatNodes.data() + range.first);
+        uploadedNodes += range.second - range.first;
+    }
+    int uploadedRecords = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, leafRecordsToSendToShader);
+    for (const pair<int, int> &range : FlatBvhNode::getDirtyRanges(changedRecords, 16)) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, range.first * sizeof(TriangleRecord),
+                        (range.second - range.first) * sizeof(TriangleRecord), leafRecords.data() + range.first);
+        uploadedRecords += range.second - range.first;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    refitTime += chrono::steady_clock::now() - refitStart;
+    refitUploadedNodes += uploadedNodes;
+    refitUploadedRecords += uploadedRecords;
+    refitFrames++;
+    if (refitFrames == 100) {
+        cout << "Refit: " << refitTime.count() / refitFrames << " ms per frame, " << refitUploadedNodes / refitFrames
+             << " of " << flatNodes.size() << " nodes and " << refitUploadedRecords / refitFrames << " of "
+             << leafRecords.size() << " triangle records uploaded per frame, SAH cost " << sahCost << endl;
+        refitTime = chrono::duration<double, milli>(0);
+        refitUploadedNodes = 0;
+        refitUploadedRecords = 0;
+        refitFrames = 0;
+    }
+}
+
+void Init::rebuildBvhTree() {
+    auto buildStart = chrono::steady_clock::now();
+    BvhNodeArena arena;
+    BvhNode *tree = arena.allocate(1);
+    // The build starts from the triangles of the loaded model, the copies the split BVH made for the previous tree
+    // would be copied again.
+    mymodel.indicesInModel = restTriangles;
+    mymodel.materialIndicesInModel = restTriangleMaterials;
+    vector<int> triangleIndices = tree->buildTree(mymodel.indicesInModel, settings.bvh, arena);
+    // The vertices keep their order, the animation moves them by their index.
+    mymodel.reorderTriangles(triangleIndices);
+    flatNodes = FlatBvhNode::putNodeIntoArray(*tree);
+
+    leafRecords = TriangleRecord::buildRecords(mymodel.indicesInModel, mymodel.allPositionVertices);
+    builtSahCost = FlatBvhNode::getSahCost(flatNodes, settings.bvh);
+    uploadTreeBuffers();
+
+    chrono::duration<double, milli> buildTime = chrono::steady_clock::now() - buildStart;
+    cout << "Rebuild time: " << buildTime.count() << " ms, SAH cost: " << builtSahCost << endl;
+}
+
+/* The copies of the model stand on a square grid behind the origin, each one turned around its vertical axis. The
+ * bottom-level tree is the tree of the model, only the instances and the top-level tree are added per copy.
+ */
+void Init::placeInstances() {
+    glm::vec3 modelMin = flatNodes[0].getMin();
+    glm::vec3 modelMax = flatNodes[0].getMax();
+    glm::vec3 modelCenter = (modelMin + modelMax) * 0.5f;
+    glm::vec3 modelExtent = modelMax - modelMin;
+    // The diagonal of the ground plan, so the turned copies do not overlap.
+    float spacing = 1.2f * sqrt(modelExtent.x * modelExtent.x + modelExtent.z * modelExtent.z);
+    int columns = int(ceil(sqrt(float(settings.instanceCount))));
+
+    instancePositions.clear();
+    for (int i = 0; i < settings.instanceCount; i++) {
+        int column = i % columns;
+        int row = i / columns;
+        instancePositions.push_back(glm::vec3((column - (columns - 1) * 0.5f) * spacing, 0, -row * spacing));
+    }
+    instanceCenter = modelCenter;
+
+    auto buildStart = chrono::steady_clock::now();
+    moveInstances(0);
+    chrono::duration<double, milli> buildTime = chrono::steady_clock::now() - buildStart;
+
+    size_t bottomLevelSize = flatNodes.size() * sizeof(FlatBvhNode) + leafRecords.size() * sizeof(TriangleRecord);
+    size_t topLevelSize = topNodes.size() * sizeof(FlatBvhNode) + instances.size() * sizeof(Instance);
+    cout << "Instances: " << instances.size() << ", triangles in the scene: "
+         << long(instances.size()) * mymodel.indicesInModel.size() << ", stored triangles: "
+         << mymodel.indicesInModel.size() << endl;
+    cout << "Top-level tree: " << topNodes.size() << " nodes, built and uploaded in " << buildTime.count()
+         << " ms, " << topLevelSize / 1024 << " KB next to the " << bottomLevelSize / 1024
+         << " KB of the bottom-level tree" << endl;
+
+    const int columnsOfRays = 160;
+    const int rowsOfRays = 90;
+    long visitedNodes = 0;
+    long testedTriangles = 0;
+    for (int y = 0; y < rowsOfRays; y++) {
+        for (int x = 0; x < columnsOfRays; x++) {
+            Ray ray = getPrimaryRay(x, y, columnsOfRays, rowsOfRays);
+            float closestT = 3.402823466e+38f;
+            int visited = 0;
+            int triangles = 0;
+            TopLevelBvh::traceForStatistics(topNodes, instances, flatNodes, leafRecords, ray, closestT, visited,
+                                            triangles);
+            visitedNodes += visited;
+            testedTriangles += triangles;
+        }
+    }
+    cout << "Two-level traversal: " << float(visitedNodes) / (columnsOfRays * rowsOfRays)
+         << " visited nodes per primary ray, " << float(testedTriangles) / (columnsOfRays * rowsOfRays)
+         << " tested triangles per primary ray\n" << endl;
+}
+
+// Turns the copies for the given time. The bottom-level tree stays, only the top-level tree is rebuilt and uploaded.
+void Init::moveInstances(float time) {
+    instances.clear();
+    for (int i = 0; i < instancePositions.size(); i++) {
+        float angle = 0.7f * i + 0.5f * time;
+        glm::mat4 objectToWorld = glm::translate(glm::mat4(1.0f), instancePositions[i]) *
+                                  glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0, 1, 0)) *
+                                  glm::translate(glm::mat4(1.0f), -instanceCenter);
+        instances.push_back(TopLevelBvh::makeInstance(objectToWorld, 0));
+    }
+    topNodes = TopLevelBvh::build(instances, flatNodes);
+
+    if (instancesToSendToShader == 0) {
+        glGenBuffers(1, &instancesToSendToShader);
+        glGenBuffers(1, &topNodesToSendToShader);
+    }
+    GLenum usage = settings.animate ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instancesToSendToShader);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(Instance), instances.data(), usage);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 7, instancesToSendToShader, 0, instances.size() * sizeof(Instance));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, topNodesToSendToShader);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, topNodes.size() * sizeof(FlatBvhNode), topNodes.data(), usage);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 8, topNodesToSendToShader, 0, topNodes.size() * sizeof(FlatBvhNode));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Init::readShadowCounters() {
+    shadowCounterFrames++;
+    if (shadowCounterFrames < 100) {
+        return;
+    }
+
+    // The shader wrote the counters through the storage buffer, the barrier makes the writes visible to the read.
+    GLuint shadowCounters[2];
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, shadowCountersToSendToShader);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(shadowCounters), shadowCounters);
+    cout << "Shadow rays: " << shadowCounters[0] / shadowCounterFrames << " per frame, "
+         << (shadowCounters[0] > 0 ? 100.0 * shadowCounters[1] / shadowCounters[0] : 0)
+         << "% stopped at the first blocking triangle" << endl;
+
+    shadowCounters[0] = 0;
+    shadowCounters[1] = 0;
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(shadowCounters), shadowCounters);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    shadowCounterFrames = 0;
+}
+
+void Init::printStatistics(const BvhStatistics &statistics) {
+    if (settings.statisticsPath.empty()) {
+        statistics.print(cout, settings.statisticsFormat);
+        return;
+    }
+    ofstream file(settings.statisticsPath);
+    statistics.print(file, settings.statisticsFormat);
+    if (file) {
+        cout << "The statistics of the tree are written to " << settings.statisticsPath << endl;
+    } else {
+        cout << "The statistics of the tree could not be written to " << settings.statisticsPath << endl;
+    }
+}
+
+void Init::compareBuilders() {
+    vector<BvhSettings> builders(4, settings.bvh);
+    builders[0].builderType = BuilderType::TopDown;
+    builders[0].splitMethod = SplitMethod::CentroidMidpoint;
+    builders[1].builderType = BuilderType::TopDown;
+    builders[1].splitMethod = SplitMethod::BinnedSah;
+    builders[2].builderType = BuilderType::Linear;
+    builders[3].builderType = BuilderType::Spatial;
+
+    cout << "Comparison of the BVH builders:" << endl;
+    cout << "------------------- " << endl;
+    for (const BvhSettings &builder : builders) {
+        auto buildStart = chrono::steady_clock::now();
+        BvhNodeArena arena;
+        BvhNode *tree = arena.allocate(1);
+        vector<int> triangleIndices = tree->buildTree(mymodel.indicesInModel, builder, arena);
+        chrono::duration<double, milli> buildTime = chrono::steady_clock::now() - buildStart;
+
+        float nodesPerRay, trianglesPerRay;
+        measureTraversal(tree, triangleIndices, nodesPerRay, trianglesPerRay);
+
+        cout << builder.getBuilderName() << " | build time: " << buildTime.count() << " ms | SAH cost: "
+             << tree->getSahCost(builder) << " | sibling overlap: " << tree->getSiblingOverlap()
+             << " | nodes per ray: " << nodesPerRay << " | triangles per ray: " << trianglesPerRay << endl;
+    }
+    cout << endl;
+}
+
+void Init::measureTraversal(const BvhNode *tree, const vector<int> &triangleIndices, float &nodesPerRay,
+                            float &trianglesPerRay) {
+    const int columns = 160;
+    const int rows = 90;
+    long visitedNodes = 0;
+    long testedTriangles = 0;
+
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++) {
+            Ray ray = getPrimaryRay(x, y, columns, rows);
+            float closestT = 3.402823466e+38f;
+            int nodes = 0;
+            int triangles = 0;
+            tree->traceForStatistics(ray, mymodel.indicesInModel, triangleIndices, closestT, nodes, triangles);
+            visitedNodes += nodes;
+            testedTriangles += triangles;
+        }
+    }
+
+    nodesPerRay = float(visitedNodes) / (columns * rows);
+    trianglesPerRay = float(testedTriangles) / (columns * rows);
+}
+
+void Init::measureFlatTraversal(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                                float &nodesPerRay, float &trianglesPerRay) {
+    const int columns = 160;
+    const int rows = 90;
+    long visitedNodes = 0;
+    long testedTriangles = 0;
+
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++) {
+            Ray ray = getPrimaryRay(x, y, columns, rows);
+            float closestT = 3.402823466e+38f;
+            int visited = 0;
+            int triangles = 0;
+            FlatBvhNode::traceForStatistics(nodes, leafRecords, ray, closestT, visited, triangles);
+            visitedNodes += visited;
+            testedTriangles += triangles;
+        }
+    }
+
+    nodesPerRay = float(visitedNodes) / (columns * rows);
+    trianglesPerRay = float(testedTriangles) / (columns * rows);
+}
+
+/* Traces the primary ray grid a few times through the flat tree, once reading the vertices of the triangles through
+ * their indices and once reading the precomputed records. The box tests are the same for both, so the difference of the
+ * triangle tests per second comes from the triangle test.
+ */
+void Init::benchmarkTriangleTests(const vector<FlatBvhNode> &nodes, const vector<glm::uvec3> &leafTriangles,
+                                  const vector<TriangleRecord> &leafRecords) {
+    const int columns = 160;
+    const int rows = 90;
+    const int repetitions = 10;
+
+    vector<Ray> rays;
+    rays.reserve(columns * rows);
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++) {
+            rays.push_back(getPrimaryRay(x, y, columns, rows));
+        }
+    }
+
+    auto measure = [&](const auto &leafData) {
+        long testedTriangles = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++) {
+            for (const Ray &ray : rays) {
+                float closestT = 3.402823466e+38f;
+                int visited = 0;
+                int triangles = 0;
+                FlatBvhNode::traceForStatistics(nodes, leafData, ray, closestT, visited, triangles);
+                testedTriangles += triangles;
+            }
+        }
+        chrono::duration<double> time = chrono::steady_clock::now() - start;
+        return testedTriangles / time.count();
+    };
+
+    double indexedRate = measure(leafTriangles);
+    double recordRate = measure(leafRecords);
+    cout << "Triangle tests per second on the CPU: " << indexedRate / 1e6 << " M through vertex indices, "
+         << recordRate / 1e6 << " M with precomputed records (" << recordRate / indexedRate << "x)\n" << endl;
+}
+
+void Init::compareLayouts(const vector<FlatBvhNode> &binaryNodes, const vector<WideBvhNode<4>> &wideNodes4,
+                          const vector<WideBvhNode<8>> &wideNodes8, const vector<CompressedBvhNode> &compressedNodes,
+                          const vector<TriangleRecord> &leafRecords) {
+    const int columns = 160;
+    const int rows = 90;
+    const int repetitions = 10;
+
+    vector<Ray> rays;
+    rays.reserve(columns * rows);
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++) {
+            rays.push_back(getPrimaryRay(x, y, columns, rows));
+        }
+    }
+
+    auto measure = [&](const char *name, size_t nodeCount, size_t nodeSize, const auto &trace) {
+        long visitedNodes = 0;
+        long testedTriangles = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++) {
+            for (const Ray &ray : rays) {
+                float closestT = 3.402823466e+38f;
+                int visited = 0;
+                int triangles = 0;
+                trace(ray, closestT, visited, triangles);
+                visitedNodes += visited;
+                testedTriangles += triangles;
+            }
+        }
+        chrono::duration<double> time = chrono::steady_clock::now() - start;
+        double traced = double(repetitions) * rays.size();
+
+        cout << name << " | nodes: " << nodeCount << " (" << nodeCount * nodeSize / 1024 << " KB) | node fetches per ray: "
+             << visitedNodes / traced << " | triangles per ray: " << testedTriangles / traced << " | "
+             << traced / time.count() / 1e6 << " Mrays/s" << endl;
+    };
+
+    cout << "Comparison of the tree layouts on the CPU:" << endl;
+    cout << "------------------- " << endl;
+    measure("binary", binaryNodes.size(), sizeof(FlatBvhNode),
+            [&](const Ray &ray, float &closestT, int &visited, int &triangles) {
+                FlatBvhNode::traceForStatistics(binaryNodes, leafRecords, ray, closestT, visited, triangles);
+            });
+    measure("BVH4", wideNodes4.size(), sizeof(WideBvhNode<4>),
+            [&](const Ray &ray, float &closestT, int &visited, int &triangles) {
+                WideBvh<4>::traceForStatistics(wideNodes4, leafRecords, ray, closestT, visited, triangles);
+            });
+    measure("BVH8", wideNodes8.size(), sizeof(WideBvhNode<8>),
+            [&](const Ray &ray, float &closestT, int &visited, int &triangles) {
+                WideBvh<8>::traceForStatistics(wideNodes8, leafRecords, ray, closestT, visited, triangles);
+            });
+    if (!compressedNodes.empty()) {
+        measure("compressed BVH4", compressedNodes.size(), sizeof(CompressedBvhNode),
+                [&](const Ray &ray, float &closestT, int &visited, int &triangles) {
+                    CompressedBvh::traceForStatistics(compressedNodes, leafRecords, ray, closestT, visited, triangles);
+                });
+    }
+    cout << endl;
+}
+
+// The same rays as the ones the vertex shader sets up for the pixels of the quad.
+Ray Init::getPrimaryRay(int x, int y, int columns, int rows) {
+    glm::vec2 normQuadCoord((x + 0.5f) / columns * 2 - 1, (y + 0.5f) / rows * 2 - 1);
+    glm::vec3 pixel = camera.getViewPoint() + canvasX * normQuadCoord.x + camera.getUpVector() * normQuadCoord.y;
+
+    Ray ray;
+    ray.orig = camera.getPosCamera();
+    ray.dir = glm::normalize(pixel - camera.getPosCamera());
+    return ray;
 }
 
 void Init::framebuffer_size_callback(GLFWwindow *window, int width, int height) {
@@ -108,15 +740,18 @@ int Init::setup() {
 
     std::cout << "glewInit: " << glewInit << std::endl;
     std::cout << "OpenGl Version: " << glGetString(GL_VERSION) << "\n" << std::endl;
-    mymodel = Model("../model/CornellBox-Original.obj");
-
-    /* If throwing an instance of 'std::out_of_range', increase the number of 'indices' array size in struct 'FlatBvhNode'
-    *  and the 'indices' array size in fragmentQuad.shader to the largest number of triangles in a leaf (info in console during runtime).
-    */
     createQuadShaderProg("../Shaders/vertexQuad.shader", "../Shaders/fragmentQuad.shader");
 
+    // The vertices are sent after the build, which puts them into the order of the leaves.
+    loadScene();
     sendVerticesIndices();
-    buildBvhTree();
+
+    GLuint shadowCounters[2] = {0, 0};
+    glGenBuffers(1, &shadowCountersToSendToShader);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, shadowCountersToSendToShader);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(shadowCounters), shadowCounters, GL_DYNAMIC_READ);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, shadowCountersToSendToShader);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
     unsigned int texture1;
     glGenTextures(1, &texture1);
@@ -146,6 +781,11 @@ void Init::loop() {
     while (!glfwWindowShouldClose(window)) {
 
         getInputFromKeyboard(window);
+        if (settings.animate && !instances.empty()) {
+            moveInstances(float(glfwGetTime()));
+        } else if (settings.animate) {
+            animateModel(float(glfwGetTime()));
+        }
         glClearColor(0.5f, 0.5f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -153,6 +793,12 @@ void Init::loop() {
         shaderQuadProgram.useProgram();
 
         glUniform1i(glGetUniformLocation(shaderQuadProgram.getShaderProgram_id(), "texture1"), 0);
+        glUniform1i(glGetUniformLocation(shaderQuadProgram.getShaderProgram_id(), "bvhLayout"),
+                    int(bvhLayout));
+        glUniform1i(glGetUniformLocation(shaderQuadProgram.getShaderProgram_id(), "instanceCount"),
+                    int(instances.size()));
+        glUniform1i(glGetUniformLocation(shaderQuadProgram.getShaderProgram_id(), "countShadowRays"),
+                    int(settings.countShadowRays));
         glUniform3fv(glGetUniformLocation(shaderQuadProgram.getShaderProgram_id(), "viewPoint"), 1,
                      &camera.getViewPoint().x);
         glUniform3fv(glGetUniformLocation(shaderQuadProgram.getShaderProgram_id(), "canvasX"), 1, &canvasX.x);
@@ -168,6 +814,9 @@ void Init::loop() {
                      &light.position.x);
 
         renderQuad();
+        if (settings.countShadowRays) {
+            readShadowCounters();
+        }
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -225,8 +874,10 @@ void Init::getInputFromKeyboard(GLFWwindow *window) {
     }
 }
 
-Init::Init()
+Init::Init(const Settings &settings)
         : SCR_W_H(1280.0f, 720.0f),
+          settings(settings),
+          bvhLayout(settings.bvh.layout),
           camera(45 * (float)M_PI / 180, glm::vec3(0, 2, 24), glm::vec3(0, 1, 0), glm::vec3(0, 0, 0)),
           light(glm::vec3(0.7, 0.5, 0.5), glm::vec3(0.7, 0.6, 0.6),
                 glm::vec3(0.7f, 0.7f, 0.7f)),
@@ -236,14 +887,26 @@ Init::Init()
           shaderQuadVertex(),
           shaderQuadFragment(),
           mymodel(),
-          bvhNode() {
+          bvhNode(),
+          builtSahCost(0),
+          nodesArraytoSendtoShader(0),
+          leafRecordsToSendToShader(0),
+          leafMaterialsToSendToShader(0),
+          instancesToSendToShader(0),
+          topNodesToSendToShader(0),
+          refitTime(0),
+          refitUploadedNodes(0),
+          refitUploadedRecords(0),
+          refitFrames(0),
+          shadowCountersToSendToShader(0),
+          shadowCounterFrames(0) {
     glfwInit();
     window = glfwCreateWindow(SCR_W_H.first, SCR_W_H.second, "FoxTracer", nullptr, nullptr);
     updateCanvasSizes();
 }
 
-int main() {
-    Init init;
+int main(int argc, char **argv) {
+    Init init(Settings::fromArguments(argc, argv));
     if (init.setup() == -1) {
         return -1;
     }
@@ -0,0 +1,178 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <array>
+#include <future>
+#include <functional>
+
+#include "../includes/lbvh.h"
+#include "../includes/glm/glm.hpp"
+
+// Runs task(0)..task(taskCount-1), all of them but the first on new threads.
+static void runTasks(int taskCount, const function<void(int)> &task) {
+    vector<future<void>> tasks;
+    for (int t = 1; t < taskCount; t++) {
+        tasks.push_back(async(launch::async, task, t));
+    }
+    task(0);
+    for (future<void> &other : tasks) {
+        other.get();
+    }
+}
+
+uint64_t Lbvh::expandBits(uint64_t value) {
+    // Inserting two zero bits between each of the lowest 21 bits.
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffff;
+    value = (value | value << 16) & 0x1f0000ff0000ff;
+    value = (value | value << 8) & 0x100f00f00f00f00f;
+    value = (value | value << 4) & 0x10c30c30c30c30c3;
+    value = (value | value << 2) & 0x1249249249249249;
+    return value;
+}
+
+vector<uint64_t> Lbvh::sortByMortonCode(BuildPrimitives &primitives, int mortonBits, int taskCount) {
+    int n = primitives.size();
+    int chunkSize = (n + taskCount - 1) / taskCount;
+
+    // Bounds of the centroids, the Morton grid is laid over them.
+    vector<glm::vec3> chunkMin(taskCount, glm::vec3(99999, 99999, 99999));
+    vector<glm::vec3> chunkMax(taskCount, glm::vec3(-99999, -99999, -99999));
+    runTasks(taskCount, [&](int t) {
+        for (int i = t * chunkSize; i < n && i < (t + 1) * chunkSize; i++) {
+            chunkMin[t] = glm::min(chunkMin[t], primitives.centroids[i]);
+            chunkMax[t] = glm::max(chunkMax[t], primitives.centroids[i]);
+        }
+    });
+
+    glm::vec3 centerMin = chunkMin[0];
+    glm::vec3 centerMax = chunkMax[0];
+    for (int t = 1; t < taskCount; t++) {
+        centerMin = glm::min(centerMin, chunkMin[t]);
+        centerMax = glm::max(centerMax, chunkMax[t]);
+    }
+
+    int bitsPerAxis = mortonBits / 3;
+    float cells = float((uint64_t(1) << bitsPerAxis) - 1);
+    glm::vec3 extent = centerMax - centerMin;
+    glm::vec3 scale(extent.x > 0 ? cells / extent.x : 0, extent.y > 0 ? cells / extent.y : 0,
+                    extent.z > 0 ? cells / extent.z : 0);
+
+    vector<uint64_t> codes(n);
+    runTasks(taskCount, [&](int t) {
+        for (int i = t * chunkSize; i < n && i < (t + 1) * chunkSize; i++) {
+            glm::vec3 cell = (primitives.centroids[primitives.triangleOrder[i]] - centerMin) * scale;
+            codes[i] = expandBits(uint64_t(cell.x)) << 2 | expandBits(uint64_t(cell.y)) << 1 |
+                       expandBits(uint64_t(cell.z));
+        }
+    });
+
+    radixSort(codes, primitives.triangleOrder, bitsPerAxis * 3, taskCount);
+    return codes;
+}
+
+/* Least significant digit radix sort with 8 bit digits. In each pass every task counts the digits of its own chunk,
+ * the counts are turned into the output positions of the chunks (digit by digit, task by task), then every task
+ * scatters its chunk. The chunks keep their order, so the passes are stable.
+ */
+void Lbvh::radixSort(vector<uint64_t> &keys, vector<int> &values, int bits, int taskCount) {
+    const int radix = 256;
+    int n = keys.size();
+    int chunkSize = (n + taskCount - 1) / taskCount;
+
+    vector<uint64_t> keysBuffer(n);
+    vector<int> valuesBuffer(n);
+    vector<array<int, radix>> offsets(taskCount);
+
+    for (int shift = 0; shift < bits; shift += 8) {
+        runTasks(taskCount, [&](int t) {
+            offsets[t].fill(0);
+            for (int i = t * chunkSize; i < n && i < (t + 1) * chunkSize; i++) {
+                offsets[t][(keys[i] >> shift) & (radix - 1)]++;
+            }
+        });
+
+        int position = 0;
+        for (int digit = 0; digit < radix; digit++) {
+            for (int t = 0; t < taskCount; t++) {
+                int count = offsets[t][digit];
+                offsets[t][digit] = position;
+                position += count;
+            }
+        }
+
+        runTasks(taskCount, [&](int t) {
+            for (int i = t * chunkSize; i < n && i < (t + 1) * chunkSize; i++) {
+                int target = offsets[t][(keys[i] >> shift) & (radix - 1)]++;
+                keysBuffer[target] = keys[i];
+                valuesBuffer[target] = values[i];
+            }
+        });
+
+        keys.swap(keysBuffer);
+        values.swap(valuesBuffer);
+    }
+}
+
+// Length of the common prefix of two sorted codes, equal codes are told apart by their position.
+int Lbvh::commonPrefix(const vector<uint64_t> &codes, int i, int j) {
+    if (j < 0 || j >= codes.size()) {
+        return -1;
+    }
+    if (codes[i] == codes[j]) {
+        return 64 + __builtin_clz(uint32_t(i ^ j));
+    }
+    return __builtin_clzll(codes[i] ^ codes[j]);
+}
+
+vector<LbvhNode> Lbvh::emitHierarchy(const vector<uint64_t> &sortedCodes, int taskCount) {
+    int internalNodes = int(sortedCodes.size()) - 1;
+    vector<LbvhNode> nodes(internalNodes > 0 ? internalNodes : 0);
+    if (internalNodes <= 0) {
+        return nodes;
+    }
+
+    taskCount = internalNodes < taskCount ? 1 : taskCount;
+    int chunkSize = (internalNodes + taskCount - 1) / taskCount;
+    runTasks(taskCount, [&](int t) {
+        emitRange(sortedCodes, nodes, t * chunkSize, glm::min((t + 1) * chunkSize, internalNodes));
+    });
+    return nodes;
+}
+
+void Lbvh::emitRange(const vector<uint64_t> &codes, vector<LbvhNode> &nodes, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        // The direction of the range covered by node i is towards the neighbour with the longer common prefix.
+        int direction = commonPrefix(codes, i, i + 1) - commonPrefix(codes, i, i - 1) > 0 ? 1 : -1;
+        int prefixMin = commonPrefix(codes, i, i - direction);
+
+        // Exponential, then binary search for the other end of the range.
+        int lengthMax = 2;
+        while (commonPrefix(codes, i, i + lengthMax * direction) > prefixMin) {
+            lengthMax *= 2;
+        }
+        int length = 0;
+        for (int step = lengthMax / 2; step >= 1; step /= 2) {
+            if (commonPrefix(codes, i, i + (length + step) * direction) > prefixMin) {
+                length += step;
+            }
+        }
+        int j = i + length * direction;
+
+        // Binary search for the last code that shares the prefix of the whole range with code i.
+        int prefixNode = commonPrefix(codes, i, j);
+        int split = 0;
+        int step = length;
+        do {
+            step = (step + 1) / 2;
+            if (commonPrefix(codes, i, i + (split + step) * direction) > prefixNode) {
+                split += step;
+            }
+        } while (step > 1);
+
+        nodes[i].first = glm::min(i, j);
+        nodes[i].last = glm::max(i, j);
+        nodes[i].split = i + split * direction + glm::min(direction, 0);
+    }
+}
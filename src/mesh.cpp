@@ -23,6 +23,7 @@ Mesh::Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> text
 
 // Render the mesh
 void Mesh::Draw() {
+#ifndef HEADLESS
     // Bind appropriate textures
     GLuint diffuseNr = 1;
     GLuint specularNr = 1;
@@ -64,11 +65,13 @@ void Mesh::Draw() {
         glActiveTexture(GL_TEXTURE0 + i);
         glBindTexture(GL_TEXTURE_2D, 0);
     }
+#endif
 }
 
 /*  Functions    */
 // Initializes all the buffer objects/arrays
 void Mesh::setupMesh() {
+#ifndef HEADLESS
     // Create buffers/arrays
     glGenVertexArrays(1, &this->VAO);
     glGenBuffers(1, &this->VBO);
@@ -100,4 +103,5 @@ void Mesh::setupMesh() {
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *) offsetof(Vertex, TexCoords));
 
     glBindVertexArray(0);
+#endif
 }
\ No newline at end of file
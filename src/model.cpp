@@ -9,6 +9,10 @@
  * Attribution-NonCommercial 4.0 International (CC BY-NC 4.0), Creative Commons
 */
 
+#include <algorithm>
+#include <limits>
+#include <tuple>
+
 #include "../includes/model.h"
 
 using namespace std;
@@ -21,6 +25,7 @@ Model::Model(string path) :
         meshes(),
         allPositionVertices(),
         indicesInModel(),
+        materialIndicesInModel(),
         materials(),
         textures_loaded() {
     this->loadModel(path);
@@ -45,6 +50,63 @@ void Model::getInfoAboutModel() {
 }
 
 
+void Model::reorderTriangles(const vector<int> &triangleOrder) {
+    vector<glm::uvec3> triangles(triangleOrder.size());
+    vector<unsigned int> triangleMaterials(triangleOrder.size());
+    for (int i = 0; i < triangleOrder.size(); i++) {
+        triangles[i] = indicesInModel[triangleOrder[i]];
+        triangleMaterials[i] = materialIndicesInModel[triangleOrder[i]];
+    }
+    indicesInModel.swap(triangles);
+    materialIndicesInModel.swap(triangleMaterials);
+}
+
+void Model::getUniqueTriangles(vector<glm::uvec3> &triangles, vector<unsigned int> &triangleMaterials) const {
+    // The copies of a triangle have the same vertices and material, sorting brings them next to each other.
+    auto key = [&](int i) {
+        const glm::uvec3 &triangle = indicesInModel[i];
+        return make_tuple(triangle.x, triangle.y, triangle.z, materialIndicesInModel[i], i);
+    };
+    vector<int> order(indicesInModel.size());
+    for (int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) { return key(a) < key(b); });
+
+    vector<char> isCopy(indicesInModel.size(), 0);
+    for (int i = 1; i < order.size(); i++) {
+        isCopy[order[i]] = indicesInModel[order[i]] == indicesInModel[order[i - 1]] &&
+                           materialIndicesInModel[order[i]] == materialIndicesInModel[order[i - 1]];
+    }
+
+    triangles.clear();
+    triangleMaterials.clear();
+    for (int i = 0; i < indicesInModel.size(); i++) {
+        if (!isCopy[i]) {
+            triangles.push_back(indicesInModel[i]);
+            triangleMaterials.push_back(materialIndicesInModel[i]);
+        }
+    }
+}
+
+void Model::reorderVertices() {
+    const unsigned int notUsedYet = numeric_limits<unsigned int>::max();
+    vector<unsigned int> newIndices(allPositionVertices.size(), notUsedYet);
+    vector<glm::vec4> vertices;
+    vertices.reserve(allPositionVertices.size());
+
+    for (glm::uvec3 &triangle : indicesInModel) {
+        for (int k = 0; k < 3; k++) {
+            if (newIndices[triangle[k]] == notUsedYet) {
+                newIndices[triangle[k]] = vertices.size();
+                vertices.push_back(allPositionVertices[triangle[k]]);
+            }
+            triangle[k] = newIndices[triangle[k]];
+        }
+    }
+    allPositionVertices.swap(vertices);
+}
+
 /*  Functions   */
 // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 void Model::loadModel(string path) {
@@ -182,15 +244,9 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
         aiFace face = mesh->mFaces[i];
         // Retrieve all indices of the face and store them in the indices vector
 
-        glm::vec4 vec3FacePlusMatIndex;
-
-
-        vec3FacePlusMatIndex.x = face.mIndices[0] + offset;
-        vec3FacePlusMatIndex.y = face.mIndices[1] + offset;
-        vec3FacePlusMatIndex.z = face.mIndices[2] + offset;
-
-        vec3FacePlusMatIndex.w = materials.size() - 1;
-        indicesInModel.push_back(vec3FacePlusMatIndex);
+        glm::uvec3 face3Indices(face.mIndices[0] + offset, face.mIndices[1] + offset, face.mIndices[2] + offset);
+        indicesInModel.push_back(face3Indices);
+        materialIndicesInModel.push_back(materials.size() - 1);
 
         /*  for (GLuint j = 0; j < face.mNumIndices; j++) {
               indices.push_back(face.mIndices[j]);
@@ -241,7 +297,10 @@ vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type,
 
 GLint Model::TextureFromFile(const char *path, string directory) {
     //Generate texture ID and load texture data
-
+#ifdef HEADLESS
+    // Without a GL context there is nothing to upload the texture to.
+    return 0;
+#else
     string filename = string(path);
     filename = directory + '/' + filename;
     GLuint textureID;
@@ -265,6 +324,7 @@ GLint Model::TextureFromFile(const char *path, string directory) {
     stbi_image_free(image);
 
     return textureID;
+#endif
 }
 
 
@@ -0,0 +1,47 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include "../includes/ray.h"
+
+bool rayIntersectWithBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const Ray &ray, float maxT, float &entryT) {
+    glm::vec3 invdir = 1.0f / ray.dir;
+    glm::vec3 n = (boxMin - ray.orig) * invdir;
+    glm::vec3 f = (boxMax - ray.orig) * invdir;
+
+    glm::vec3 tmin = glm::min(n, f);
+    glm::vec3 tmax = glm::max(n, f);
+
+    float enter = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+    float exit = glm::min(glm::min(tmax.x, tmax.y), glm::min(tmax.z, maxT));
+
+    entryT = enter;
+    return enter <= exit;
+}
+
+float rayTriangleIntersect(const Ray &ray, const glm::vec3 &pointA, const glm::vec3 &pointB, const glm::vec3 &pointC) {
+    glm::vec3 pApB = pointB - pointA;
+    glm::vec3 pApC = pointC - pointA;
+    glm::vec3 vec90 = glm::cross(ray.dir, pApC);
+    float determinant = glm::dot(vec90, pApB);
+
+    if (determinant == 0) {
+        return -1;
+    }
+    float determinantInv = 1 / determinant;
+
+    glm::vec3 vecT = ray.orig - pointA;
+    float u = determinantInv * glm::dot(vecT, vec90);
+    if (u < 0 || u > 1) {
+        return -1;
+    }
+
+    glm::vec3 vecQ = glm::cross(vecT, pApB);
+    float v = determinantInv * glm::dot(vecQ, ray.dir);
+    if (v < 0 || u + v > 1) {
+        return -1;
+    }
+
+    float t = glm::dot(pApC, vecQ) * determinantInv;
+    return t > 0 ? t : -1;
+}
@@ -0,0 +1,270 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <climits>
+
+#include "../includes/raypacket.h"
+
+// Vectors of the GCC vector extensions, a comparison gives -1 in the lanes where it holds. The kernels below are
+// compiled for AVX2 and AVX-512, so these become one ymm or zmm register.
+typedef float Floats8 __attribute__((vector_size(32)));
+typedef int Ints8 __attribute__((vector_size(32)));
+typedef float Floats16 __attribute__((vector_size(64)));
+typedef int Ints16 __attribute__((vector_size(64)));
+
+static const float noHit = 3.402823466e+38f;
+// The end of the traversal is above every node, so the node the packet visits next is the lowest one of its rays.
+static const int traversalEnd = INT_MAX;
+
+/* The packet loop. The box and the triangle tests are the ones of rayIntersectWithBox and TriangleRecord::intersect,
+ * computed in the same order on every lane, so a ray gets the same hit as alone. It is compiled for the instruction set
+ * of its width below. With AnyHit a ray stops at its first hit, and its triangle is that one instead of the closest.
+ */
+template<typename Floats, typename Ints, int Width, bool AnyHit>
+static void tracePacket(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords, const Ray *rays,
+                        int count, float *closestT, int *triangles, PacketCounters &counters) {
+    Floats origX, origY, origZ, dirX, dirY, dirZ, invDirX, invDirY, invDirZ, maxT;
+    Ints next, hitTriangle;
+    for (int r = 0; r < Width; r++) {
+        // The missing rays of a partial packet copy the first one and wait at the end.
+        const Ray &ray = rays[r < count ? r : 0];
+        origX[r] = ray.orig.x;
+        origY[r] = ray.orig.y;
+        origZ[r] = ray.orig.z;
+        dirX[r] = ray.dir.x;
+        dirY[r] = ray.dir.y;
+        dirZ[r] = ray.dir.z;
+        invDirX[r] = 1.0f / ray.dir.x;
+        invDirY[r] = 1.0f / ray.dir.y;
+        invDirZ[r] = 1.0f / ray.dir.z;
+        maxT[r] = noHit;
+        next[r] = r < count ? 0 : traversalEnd;
+        hitTriangle[r] = -1;
+    }
+    counters.packets++;
+
+    int i = 0;
+    while (i != traversalEnd) {
+        const FlatBvhNode &node = nodes[i];
+        Ints active = next == i;
+        int activeCount = 0;
+        for (int r = 0; r < Width; r++) {
+            activeCount += active[r] != 0;
+        }
+
+        if (activeCount * 4 < count) {
+            for (int r = 0; r < count; r++) {
+                if (next[r] == traversalEnd) {
+                    continue;
+                }
+                float t = maxT[r];
+                int triangle = hitTriangle[r];
+                if (AnyHit) {
+                    int visitedNodes = 0;
+                    int testedTriangles = 0;
+                    FlatBvhNode::traverseAnyHit(nodes, rays[r], t, visitedNodes, testedTriangles, [&](int j) {
+                        float hitT = leafRecords[j].intersect(rays[r]);
+                        if (hitT > 0 && hitT < t) {
+                            triangle = j;
+                        }
+                        return hitT;
+                    }, next[r]);
+                    counters.fallbackNodes += visitedNodes;
+                } else {
+                    RayPacket::traceSingle(nodes, leafRecords, rays[r], next[r], t, triangle);
+                }
+                maxT[r] = t;
+                hitTriangle[r] = triangle;
+                counters.fallbackRays++;
+            }
+            break;
+        }
+        counters.nodeTests++;
+        counters.activeRays += activeCount;
+
+        glm::vec3 boxMin = node.getMin();
+        glm::vec3 boxMax = node.getMax();
+        Floats nearX = (boxMin.x - origX) * invDirX;
+        Floats nearY = (boxMin.y - origY) * invDirY;
+        Floats nearZ = (boxMin.z - origZ) * invDirZ;
+        Floats farX = (boxMax.x - origX) * invDirX;
+        Floats farY = (boxMax.y - origY) * invDirY;
+        Floats farZ = (boxMax.z - origZ) * invDirZ;
+
+        Floats minX = farX < nearX ? farX : nearX;
+        Floats minY = farY < nearY ? farY : nearY;
+        Floats minZ = farZ < nearZ ? farZ : nearZ;
+        Floats maxX = nearX < farX ? farX : nearX;
+        Floats maxY = nearY < farY ? farY : nearY;
+        Floats maxZ = nearZ < farZ ? farZ : nearZ;
+        Floats enterXY = minX < minY ? minY : minX;
+        Floats enterZ = minZ < 0.0f ? Floats{} : minZ;
+        Floats enter = enterXY < enterZ ? enterZ : enterXY;
+        Floats exitXY = maxY < maxX ? maxY : maxX;
+        Floats exitZ = maxT < maxZ ? maxT : maxZ;
+        Floats exit = exitZ < exitXY ? exitZ : exitXY;
+        Ints hit = active & (enter <= exit);
+
+        bool anyHit = false;
+        for (int r = 0; r < Width; r++) {
+            anyHit |= hit[r] != 0;
+        }
+
+        for (int j = node.getFirstIndex(); anyHit && j < node.getFirstIndex() + node.getIndexCount(); j++) {
+            const TriangleRecord &triangle = leafRecords[j];
+            glm::vec3 pointA(triangle.pointA);
+            glm::vec3 pApB(triangle.edgeAB);
+            glm::vec3 pApC(triangle.edgeAC);
+
+            Floats vec90X = dirY * pApC.z - pApC.y * dirZ;
+            Floats vec90Y = dirZ * pApC.x - pApC.z * dirX;
+            Floats vec90Z = dirX * pApC.y - pApC.x * dirY;
+            Floats determinant = vec90X * pApB.x + vec90Y * pApB.y + vec90Z * pApB.z;
+            Floats determinantInv = 1 / determinant;
+
+            Floats vecTX = origX - pointA.x;
+            Floats vecTY = origY - pointA.y;
+            Floats vecTZ = origZ - pointA.z;
+            Floats u = determinantInv * (vecTX * vec90X + vecTY * vec90Y + vecTZ * vec90Z);
+
+            Floats vecQX = vecTY * pApB.z - pApB.y * vecTZ;
+            Floats vecQY = vecTZ * pApB.x - pApB.z * vecTX;
+            Floats vecQZ = vecTX * pApB.y - pApB.x * vecTY;
+            Floats v = determinantInv * (vecQX * dirX + vecQY * dirY + vecQZ * dirZ);
+            Floats t = (pApC.x * vecQX + pApC.y * vecQY + pApC.z * vecQZ) * determinantInv;
+
+            // Rejected like the single ray test rejects them, a NaN does not reject the triangle on its own.
+            Ints missed = (determinant == 0) | (u < 0) | (u > 1) | (v < 0) | (u + v > 1);
+            Ints closer = hit & ~missed & (t > 0) & (t < maxT);
+            maxT = closer ? t : maxT;
+            hitTriangle = closer ? Ints{} + j : hitTriangle;
+        }
+
+        int hitLink = node.getHitLink() == -1 ? traversalEnd : node.getHitLink();
+        int missLink = node.getMissLink() == -1 ? traversalEnd : node.getMissLink();
+        next = hit ? Ints{} + hitLink : (active ? Ints{} + missLink : next);
+        if (AnyHit) {
+            next = hitTriangle != -1 ? Ints{} + traversalEnd : next;
+        }
+
+        i = traversalEnd;
+        for (int r = 0; r < Width; r++) {
+            i = MIN(i, next[r]);
+        }
+    }
+
+    for (int r = 0; r < count; r++) {
+        closestT[r] = maxT[r];
+        triangles[r] = hitTriangle[r];
+        if (AnyHit) {
+            counters.occludedRays += hitTriangle[r] != -1;
+        }
+    }
+}
+
+// The instantiations take the target of their region. Instantiated from the template inside a target function instead,
+// GCC 12 splits the 16 lane comparisons into single floats.
+#pragma GCC push_options
+#pragma GCC target("avx2")
+template void tracePacket<Floats8, Ints8, 8, false>(const vector<FlatBvhNode> &nodes,
+                                                    const vector<TriangleRecord> &leafRecords, const Ray *rays,
+                                                    int count, float *closestT, int *triangles,
+                                                    PacketCounters &counters);
+template void tracePacket<Floats8, Ints8, 8, true>(const vector<FlatBvhNode> &nodes,
+                                                   const vector<TriangleRecord> &leafRecords, const Ray *rays,
+                                                   int count, float *closestT, int *triangles,
+                                                   PacketCounters &counters);
+#pragma GCC pop_options
+
+// AVX-512 brings FMA along, the products are not fused into the sums, so the lanes round like the single ray tests.
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+template void tracePacket<Floats16, Ints16, 16, false>(const vector<FlatBvhNode> &nodes,
+                                                       const vector<TriangleRecord> &leafRecords, const Ray *rays,
+                                                       int count, float *closestT, int *triangles,
+                                                       PacketCounters &counters);
+template void tracePacket<Floats16, Ints16, 16, true>(const vector<FlatBvhNode> &nodes,
+                                                      const vector<TriangleRecord> &leafRecords, const Ray *rays,
+                                                      int count, float *closestT, int *triangles,
+                                                      PacketCounters &counters);
+#pragma GCC pop_options
+
+int RayPacket::getWidth() {
+    static const int width = __builtin_cpu_supports("avx512f") ? 16 : __builtin_cpu_supports("avx2") ? 8 : 0;
+    return width;
+}
+
+void RayPacket::getShape(int width, int &columns, int &rows) {
+    columns = 4;
+    rows = MAX(1, width / 4);
+}
+
+void RayPacket::trace(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords, const Ray *rays,
+                      int count, float *closestT, int *triangles, PacketCounters &counters) {
+    trace(getWidth(), nodes, leafRecords, rays, count, closestT, triangles, counters);
+}
+
+void RayPacket::trace(int width, const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                      const Ray *rays, int count, float *closestT, int *triangles, PacketCounters &counters) {
+    if (width == 16) {
+        tracePacket<Floats16, Ints16, 16, false>(nodes, leafRecords, rays, count, closestT, triangles, counters);
+    } else if (width == 8) {
+        tracePacket<Floats8, Ints8, 8, false>(nodes, leafRecords, rays, count, closestT, triangles, counters);
+    } else {
+        for (int r = 0; r < count; r++) {
+            closestT[r] = noHit;
+            triangles[r] = -1;
+            traceSingle(nodes, leafRecords, rays[r], 0, closestT[r], triangles[r]);
+        }
+    }
+}
+
+void RayPacket::traceOcclusion(int width, const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                               const Ray *rays, int count, bool *occluded, PacketCounters &counters) {
+    if (width == 0) {
+        for (int r = 0; r < count; r++) {
+            occluded[r] = isOccluded(nodes, leafRecords, rays[r], 0, counters.fallbackNodes);
+            counters.fallbackRays++;
+            counters.occludedRays += occluded[r];
+        }
+        return;
+    }
+
+    float closestT[16];
+    int triangles[16];
+    if (width == 16) {
+        tracePacket<Floats16, Ints16, 16, true>(nodes, leafRecords, rays, count, closestT, triangles, counters);
+    } else {
+        tracePacket<Floats8, Ints8, 8, true>(nodes, leafRecords, rays, count, closestT, triangles, counters);
+    }
+    for (int r = 0; r < count; r++) {
+        occluded[r] = triangles[r] != -1;
+    }
+}
+
+void RayPacket::traceSingle(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords,
+                            const Ray &ray, int rootNode, float &closestT, int &triangle) {
+    int visitedNodes = 0;
+    int testedTriangles = 0;
+    // The traversal keeps the distance, the triangle of the closest hit is noted here before closestT is lowered.
+    FlatBvhNode::traverse(nodes, ray, closestT, visitedNodes, testedTriangles, [&](int j) {
+        float t = leafRecords[j].intersect(ray);
+        if (t > 0 && t < closestT) {
+            triangle = j;
+        }
+        return t;
+    }, rootNode);
+}
+
+bool RayPacket::isOccluded(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords, const Ray &ray,
+                           int rootNode, long &visitedNodes) {
+    int rayVisitedNodes = 0;
+    int testedTriangles = 0;
+    bool occluded = FlatBvhNode::traverseAnyHit(nodes, ray, noHit, rayVisitedNodes, testedTriangles, [&](int j) {
+        return leafRecords[j].intersect(ray);
+    }, rootNode);
+    visitedNodes += rayVisitedNodes;
+    return occluded;
+}
@@ -0,0 +1,202 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "../includes/settings.h"
+
+using namespace std;
+
+const char *BvhSettings::getSplitMethodName() const {
+    switch (splitMethod) {
+        case SplitMethod::BinnedSah:
+            return "binned SAH";
+        case SplitMethod::CentroidMidpoint:
+        default:
+            return "average centroid";
+    }
+}
+
+string BvhSettings::getBuilderName() const {
+    string name;
+    if (builderType == BuilderType::Linear) {
+        name = "linear BVH (" + to_string(mortonBits) + " bit Morton codes)";
+    } else if (builderType == BuilderType::Spatial) {
+        name = "split BVH (" + to_string(int(spatialSplitBudget * 100)) + "% reference budget)";
+    } else {
+        name = string("top-down, ") + getSplitMethodName();
+    }
+    if (optimizeTreelets) {
+        name += " + treelet optimization";
+    }
+    return name;
+}
+
+const char *BvhSettings::getLayoutName(BvhLayout layout) {
+    switch (layout) {
+        case BvhLayout::Compressed4:
+            return "compressed BVH4";
+        case BvhLayout::Wide4:
+            return "BVH4";
+        case BvhLayout::Wide8:
+            return "BVH8";
+        case BvhLayout::Binary:
+        default:
+            return "binary";
+    }
+}
+
+// stoi and stof of the whole value, they throw invalid_argument for a value with anything after the number as well.
+static int toInt(const string &value) {
+    size_t length;
+    int number = stoi(value, &length);
+    if (length != value.size()) {
+        throw invalid_argument(value);
+    }
+    return number;
+}
+
+static float toFloat(const string &value) {
+    size_t length;
+    float number = stof(value, &length);
+    if (length != value.size()) {
+        throw invalid_argument(value);
+    }
+    return number;
+}
+
+Settings Settings::fromArguments(int argc, char **argv) {
+    Settings settings;
+    settings.bvh.buildThreads = max(1, int(thread::hardware_concurrency()));
+    settings.renderThreads = settings.bvh.buildThreads;
+
+    for (int i = 1; i < argc; i++) {
+        string argument(argv[i]);
+        size_t separator = argument.find('=');
+        string key = argument.substr(0, separator);
+        string value = separator == string::npos ? "" : argument.substr(separator + 1);
+
+        // A value that is not a number leaves the option at its default.
+        try {
+            if (key == "--model") {
+                settings.modelPath = value;
+            } else if (key == "--split") {
+                if (value == "sah") {
+                    settings.bvh.splitMethod = SplitMethod::BinnedSah;
+                } else if (value == "centroid") {
+                    settings.bvh.splitMethod = SplitMethod::CentroidMidpoint;
+                } else {
+                    cout << "Unknown split method: " << value << ", using the average centroid split." << endl;
+                }
+            } else if (key == "--builder") {
+                if (value == "lbvh") {
+                    settings.bvh.builderType = BuilderType::Linear;
+                } else if (value == "sbvh") {
+                    settings.bvh.builderType = BuilderType::Spatial;
+                } else if (value == "topdown") {
+                    settings.bvh.builderType = BuilderType::TopDown;
+                } else {
+                    cout << "Unknown builder: " << value << ", using the top-down builder." << endl;
+                }
+            } else if (key == "--morton-bits") {
+                settings.bvh.mortonBits = toInt(value) <= 30 ? 30 : 63;
+            } else if (key == "--sbvh-budget") {
+                settings.bvh.spatialSplitBudget = max(0.0f, toFloat(value));
+            } else if (key == "--keep-vertex-order") {
+                settings.reorderVertices = false;
+            } else if (key == "--compare-builders") {
+                settings.bvh.compareBuilders = true;
+            } else if (key == "--layout") {
+                if (value == "bvh4") {
+                    settings.bvh.layout = BvhLayout::Wide4;
+                } else if (value == "cbvh4") {
+                    settings.bvh.layout = BvhLayout::Compressed4;
+                } else if (value == "bvh8") {
+                    settings.bvh.layout = BvhLayout::Wide8;
+                } else if (value == "binary") {
+                    settings.bvh.layout = BvhLayout::Binary;
+                } else {
+                    cout << "Unknown layout: " << value << ", using the binary layout." << endl;
+                }
+            } else if (key == "--compare-layouts") {
+                settings.bvh.compareLayouts = true;
+            } else if (key == "--benchmark-triangle-tests") {
+                settings.bvh.benchmarkTriangleTests = true;
+            } else if (key == "--treelets") {
+                settings.bvh.optimizeTreelets = true;
+            } else if (key == "--treelet-leaves") {
+                // The optimal topology is searched over all subsets of the leaves, 3^n steps per treelet.
+                settings.bvh.treeletLeaves = min(10, max(3, toInt(value)));
+            } else if (key == "--treelet-passes") {
+                settings.bvh.treeletPasses = max(1, toInt(value));
+            } else if (key == "--treelet-time") {
+                settings.bvh.treeletTimeBudget = max(0.0f, toFloat(value));
+            } else if (key == "--animate") {
+                settings.animate = true;
+            } else if (key == "--rebuild-threshold") {
+                settings.bvh.refitRebuildThreshold = max(1.0f, toFloat(value));
+            } else if (key == "--stats") {
+                if (value == "json") {
+                    settings.statisticsFormat = StatisticsFormat::Json;
+                } else if (value == "text") {
+                    settings.statisticsFormat = StatisticsFormat::Text;
+                } else {
+                    cout << "Unknown statistics format: " << value << ", using text." << endl;
+                }
+            } else if (key == "--stats-file") {
+                settings.statisticsPath = value;
+            } else if (key == "--width") {
+                settings.imageWidth = max(1, toInt(value));
+            } else if (key == "--height") {
+                settings.imageHeight = max(1, toInt(value));
+            } else if (key == "--render-threads") {
+                settings.renderThreads = max(1, toInt(value));
+            } else if (key == "--output") {
+                settings.imagePath = value;
+            } else if (key == "--no-packets") {
+                settings.usePacketTraversal = false;
+            } else if (key == "--benchmark-packets") {
+                settings.benchmarkPackets = true;
+            } else if (key == "--no-triangle-blocks") {
+                settings.useTriangleBlocks = false;
+            } else if (key == "--benchmark-triangle-blocks") {
+                settings.benchmarkTriangleBlocks = true;
+            } else if (key == "--wavefront") {
+                settings.wavefront = true;
+            } else if (key == "--no-ray-sorting") {
+                settings.sortRays = false;
+            } else if (key == "--shadow-stats") {
+                settings.countShadowRays = true;
+            } else if (key == "--no-cache") {
+                settings.useBvhCache = false;
+            } else if (key == "--instances") {
+                settings.instanceCount = max(0, toInt(value));
+            } else if (key == "--bins") {
+                // The binned builder is meant to run with 16-32 bins per axis, fewer bins lose too much precision.
+                settings.bvh.sahBins = toInt(value);
+                if (settings.bvh.sahBins < 16) { settings.bvh.sahBins = 16; }
+                if (settings.bvh.sahBins > 32) { settings.bvh.sahBins = 32; }
+            } else if (key == "--leaf-size") {
+                settings.bvh.maxLeafSize = max(1, toInt(value));
+            } else if (key == "--max-depth") {
+                settings.bvh.maxDepth = max(0, toInt(value));
+            } else if (key == "--threads") {
+                settings.bvh.buildThreads = max(1, toInt(value));
+            } else if (key == "--parallel-cutoff") {
+                settings.bvh.parallelBuildCutoff = max(2, toInt(value));
+            } else {
+                cout << "Unknown option: " << argument << endl;
+            }
+        } catch (const invalid_argument &) {
+            cout << "Invalid value of " << key << ": '" << value << "', keeping the default." << endl;
+        } catch (const out_of_range &) {
+            cout << "Out of range value of " << key << ": '" << value << "', keeping the default." << endl;
+        }
+    }
+    return settings;
+}
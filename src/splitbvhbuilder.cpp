@@ -0,0 +1,415 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <array>
+
+#include "../includes/splitbvhbuilder.h"
+#include "../includes/bvhnode.h"
+
+static const int maxBinCount = 32;
+
+SplitBvhBuilder::SplitBvhBuilder(const BuildPrimitives &primitives, const vector<glm::vec4> &coordinates,
+                                 const BvhSettings &settings, BvhNodeArena &arena) :
+        primitives(primitives),
+        coordinates(coordinates),
+        settings(settings),
+        arena(arena),
+        rootArea(0),
+        referenceBudget(0),
+        numberOfReferences(0),
+        numberOfSpatialSplits(0) {
+}
+
+void SplitBvhBuilder::build(BvhNode *root) {
+    vector<SbvhReference> references(primitives.size());
+    for (int i = 0; i < primitives.size(); i++) {
+        references[i].triangle = i;
+        references[i].min = primitives.minBounds[i];
+        references[i].max = primitives.maxBounds[i];
+    }
+
+    numberOfReferences = references.size();
+    numberOfSpatialSplits = 0;
+    referenceBudget = int(settings.spatialSplitBudget * references.size());
+    triangleIndices.clear();
+    triangleIndices.reserve(references.size() + referenceBudget);
+
+    buildNode(root, references, 0);
+}
+
+void SplitBvhBuilder::buildNode(BvhNode *node, vector<SbvhReference> &references, int depth) {
+    glm::vec3 nodeMin(99999, 99999, 99999);
+    glm::vec3 nodeMax(-99999, -99999, -99999);
+    glm::vec3 center(0, 0, 0);
+
+    for (const SbvhReference &reference : references) {
+        nodeMin = glm::min(nodeMin, reference.min);
+        nodeMax = glm::max(nodeMax, reference.max);
+        center += primitives.centroids[reference.triangle];
+    }
+    center /= float(references.size());
+
+    BBox bBox(nodeMin, nodeMax, center);
+    float parentArea = bBox.getSurfaceArea();
+    if (depth == 0) {
+        rootArea = parentArea;
+    }
+
+    node->setBBox(bBox);
+    node->setDepthOfNode(depth);
+
+    if (references.size() <= settings.maxLeafSize || depth >= settings.maxDepth) {
+        makeLeaf(node, references);
+        return;
+    }
+
+    ObjectSplit objectSplit = findObjectSplit(references, parentArea);
+
+    // Spatial splits are only worth trying when the children of the object split overlap considerably.
+    float overlapArea = parentArea;
+    if (objectSplit.axis != -1) {
+        glm::vec3 overlapMin = glm::max(objectSplit.leftMin, objectSplit.rightMin);
+        glm::vec3 overlapMax = glm::min(objectSplit.leftMax, objectSplit.rightMax);
+        overlapArea = glm::all(glm::lessThanEqual(overlapMin, overlapMax)) ?
+                      BBox::getSurfaceArea(overlapMin, overlapMax) : 0;
+    }
+
+    SpatialSplit spatialSplit;
+    spatialSplit.cost = 3.402823466e+38f;
+    if (referenceBudget > 0 && rootArea > 0 && overlapArea / rootArea > settings.spatialSplitAlpha) {
+        spatialSplit = findSpatialSplit(references, nodeMin, nodeMax, parentArea);
+    }
+
+    vector<SbvhReference> left;
+    vector<SbvhReference> right;
+
+    if (spatialSplit.cost < objectSplit.cost && spatialSplit.duplicates <= referenceBudget) {
+        performSpatialSplit(references, spatialSplit, left, right);
+
+        // A split that keeps every reference on one side would never terminate.
+        if (left.size() == references.size() || right.size() == references.size()) {
+            left.clear();
+            right.clear();
+        } else {
+            int duplicates = left.size() + right.size() - references.size();
+            referenceBudget -= duplicates;
+            numberOfReferences += duplicates;
+            numberOfSpatialSplits++;
+        }
+    }
+
+    if ((left.empty() || right.empty()) && objectSplit.axis != -1) {
+        left.clear();
+        right.clear();
+        performObjectSplit(references, objectSplit, left, right);
+    }
+
+    if (left.empty() || right.empty()) {
+        makeLeaf(node, references);
+        return;
+    }
+
+    // The references of this node are not needed any more, the children own theirs.
+    vector<SbvhReference>().swap(references);
+
+    BvhNode *leftChild = arena.allocate(2);
+    BvhNode *rightChild = leftChild + 1;
+
+    buildNode(leftChild, left, depth + 1);
+    buildNode(rightChild, right, depth + 1);
+
+    leftChild->setLeftOrRight(0);
+    rightChild->setLeftOrRight(1);
+
+    node->setIsLeaf(false);
+    node->setChildren(leftChild, rightChild);
+}
+
+// The references of a leaf are appended to the triangle index list, a clipped triangle is listed in every leaf it is in.
+void SplitBvhBuilder::makeLeaf(BvhNode *node, const vector<SbvhReference> &references) {
+    node->setIsLeaf(true);
+    node->setFirstIndex(triangleIndices.size());
+    node->setIndexCount(references.size());
+    for (const SbvhReference &reference : references) {
+        triangleIndices.push_back(reference.triangle);
+    }
+}
+
+// Binned SAH over the centroids of the reference bounds, the same way as BvhNode::splitWithBinnedSah.
+SplitBvhBuilder::ObjectSplit SplitBvhBuilder::findObjectSplit(const vector<SbvhReference> &references,
+                                                              float parentArea) {
+    struct SahBin {
+        glm::vec3 min;
+        glm::vec3 max;
+        int count;
+    };
+
+    const int binCount = settings.sahBins < maxBinCount ? settings.sahBins : maxBinCount;
+    const int count = references.size();
+
+    ObjectSplit best;
+    best.cost = 3.402823466e+38f;
+    best.axis = -1;
+
+    glm::vec3 centerMin(99999, 99999, 99999);
+    glm::vec3 centerMax(-99999, -99999, -99999);
+    for (const SbvhReference &reference : references) {
+        glm::vec3 centroid = (reference.min + reference.max) * 0.5f;
+        centerMin = glm::min(centerMin, centroid);
+        centerMax = glm::max(centerMax, centroid);
+    }
+
+    array<SahBin, maxBinCount> bins;
+    array<glm::vec3, maxBinCount> rightMin;
+    array<glm::vec3, maxBinCount> rightMax;
+    array<int, maxBinCount> rightCount;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centerMax[axis] - centerMin[axis];
+        if (extent <= 0) {
+            continue;
+        }
+        float scale = binCount / extent;
+
+        for (int b = 0; b < binCount; b++) {
+            bins[b].min = glm::vec3(99999, 99999, 99999);
+            bins[b].max = glm::vec3(-99999, -99999, -99999);
+            bins[b].count = 0;
+        }
+
+        for (const SbvhReference &reference : references) {
+            float centroid = (reference.min[axis] + reference.max[axis]) * 0.5f;
+            int bin = glm::clamp(int((centroid - centerMin[axis]) * scale), 0, binCount - 1);
+            bins[bin].min = glm::min(bins[bin].min, reference.min);
+            bins[bin].max = glm::max(bins[bin].max, reference.max);
+            bins[bin].count++;
+        }
+
+        glm::vec3 accumulatedMin(99999, 99999, 99999);
+        glm::vec3 accumulatedMax(-99999, -99999, -99999);
+        int accumulatedCount = 0;
+        for (int plane = binCount - 2; plane >= 0; plane--) {
+            accumulatedMin = glm::min(accumulatedMin, bins[plane + 1].min);
+            accumulatedMax = glm::max(accumulatedMax, bins[plane + 1].max);
+            accumulatedCount += bins[plane + 1].count;
+            rightMin[plane] = accumulatedMin;
+            rightMax[plane] = accumulatedMax;
+            rightCount[plane] = accumulatedCount;
+        }
+
+        accumulatedMin = glm::vec3(99999, 99999, 99999);
+        accumulatedMax = glm::vec3(-99999, -99999, -99999);
+        accumulatedCount = 0;
+        for (int plane = 0; plane < binCount - 1; plane++) {
+            accumulatedMin = glm::min(accumulatedMin, bins[plane].min);
+            accumulatedMax = glm::max(accumulatedMax, bins[plane].max);
+            accumulatedCount += bins[plane].count;
+
+            if (accumulatedCount == 0 || accumulatedCount == count) {
+                continue;
+            }
+
+            float cost = settings.traversalCost + settings.intersectionCost *
+                         (BBox::getSurfaceArea(accumulatedMin, accumulatedMax) * accumulatedCount +
+                          BBox::getSurfaceArea(rightMin[plane], rightMax[plane]) * rightCount[plane]) / parentArea;
+
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.plane = plane;
+                best.centerMin = centerMin[axis];
+                best.scale = scale;
+                best.leftMin = accumulatedMin;
+                best.leftMax = accumulatedMax;
+                best.rightMin = rightMin[plane];
+                best.rightMax = rightMax[plane];
+            }
+        }
+    }
+    return best;
+}
+
+/* The node is cut into equally wide slabs. Every reference is clipped to each slab it touches, so the bins get the
+ * tight bounds of the triangle pieces; a reference enters in its first bin and exits in its last one. On a plane the
+ * left child gets the references that entered before it and the right child the ones that exit after it.
+ */
+SplitBvhBuilder::SpatialSplit SplitBvhBuilder::findSpatialSplit(const vector<SbvhReference> &references,
+                                                                const glm::vec3 &nodeMin, const glm::vec3 &nodeMax,
+                                                                float parentArea) {
+    struct SpatialBin {
+        glm::vec3 min;
+        glm::vec3 max;
+        int entries;
+        int exits;
+    };
+
+    const int binCount = settings.sahBins < maxBinCount ? settings.sahBins : maxBinCount;
+    const int count = references.size();
+
+    SpatialSplit best;
+    best.cost = 3.402823466e+38f;
+    best.axis = -1;
+    best.duplicates = 0;
+
+    array<SpatialBin, maxBinCount> bins;
+    array<float, maxBinCount> rightCost;
+    array<int, maxBinCount> rightCount;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = nodeMax[axis] - nodeMin[axis];
+        if (extent <= 0) {
+            continue;
+        }
+        float binWidth = extent / binCount;
+
+        for (int b = 0; b < binCount; b++) {
+            bins[b].min = glm::vec3(99999, 99999, 99999);
+            bins[b].max = glm::vec3(-99999, -99999, -99999);
+            bins[b].entries = 0;
+            bins[b].exits = 0;
+        }
+
+        for (const SbvhReference &reference : references) {
+            int firstBin = glm::clamp(int((reference.min[axis] - nodeMin[axis]) / binWidth), 0, binCount - 1);
+            int lastBin = glm::clamp(int((reference.max[axis] - nodeMin[axis]) / binWidth), firstBin, binCount - 1);
+
+            for (int b = firstBin; b <= lastBin; b++) {
+                float low = nodeMin[axis] + b * binWidth;
+                float high = b == binCount - 1 ? nodeMax[axis] : low + binWidth;
+
+                glm::vec3 clippedMin;
+                glm::vec3 clippedMax;
+                if (clipReference(reference, axis, low, high, clippedMin, clippedMax)) {
+                    bins[b].min = glm::min(bins[b].min, clippedMin);
+                    bins[b].max = glm::max(bins[b].max, clippedMax);
+                }
+            }
+            bins[firstBin].entries++;
+            bins[lastBin].exits++;
+        }
+
+        glm::vec3 accumulatedMin(99999, 99999, 99999);
+        glm::vec3 accumulatedMax(-99999, -99999, -99999);
+        int accumulatedCount = 0;
+        for (int plane = binCount - 2; plane >= 0; plane--) {
+            accumulatedMin = glm::min(accumulatedMin, bins[plane + 1].min);
+            accumulatedMax = glm::max(accumulatedMax, bins[plane + 1].max);
+            accumulatedCount += bins[plane + 1].exits;
+            rightCount[plane] = accumulatedCount;
+            rightCost[plane] = accumulatedCount == 0 ? 0 :
+                               BBox::getSurfaceArea(accumulatedMin, accumulatedMax) * accumulatedCount;
+        }
+
+        accumulatedMin = glm::vec3(99999, 99999, 99999);
+        accumulatedMax = glm::vec3(-99999, -99999, -99999);
+        accumulatedCount = 0;
+        for (int plane = 0; plane < binCount - 1; plane++) {
+            accumulatedMin = glm::min(accumulatedMin, bins[plane].min);
+            accumulatedMax = glm::max(accumulatedMax, bins[plane].max);
+            accumulatedCount += bins[plane].entries;
+
+            if (accumulatedCount == 0 || rightCount[plane] == 0) {
+                continue;
+            }
+
+            float cost = settings.traversalCost + settings.intersectionCost *
+                         (BBox::getSurfaceArea(accumulatedMin, accumulatedMax) * accumulatedCount +
+                          rightCost[plane]) / parentArea;
+
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = nodeMin[axis] + (plane + 1) * binWidth;
+                best.duplicates = accumulatedCount + rightCount[plane] - count;
+            }
+        }
+    }
+    return best;
+}
+
+void SplitBvhBuilder::performObjectSplit(const vector<SbvhReference> &references, const ObjectSplit &split,
+                                         vector<SbvhReference> &left, vector<SbvhReference> &right) {
+    const int binCount = settings.sahBins < maxBinCount ? settings.sahBins : maxBinCount;
+
+    for (const SbvhReference &reference : references) {
+        float centroid = (reference.min[split.axis] + reference.max[split.axis]) * 0.5f;
+        int bin = glm::clamp(int((centroid - split.centerMin) * split.scale), 0, binCount - 1);
+        if (bin <= split.plane) {
+            left.push_back(reference);
+        } else {
+            right.push_back(reference);
+        }
+    }
+}
+
+void SplitBvhBuilder::performSpatialSplit(const vector<SbvhReference> &references, const SpatialSplit &split,
+                                          vector<SbvhReference> &left, vector<SbvhReference> &right) {
+    for (const SbvhReference &reference : references) {
+        if (reference.max[split.axis] <= split.position) {
+            left.push_back(reference);
+        } else if (reference.min[split.axis] >= split.position) {
+            right.push_back(reference);
+        } else {
+            // The triangle straddles the plane, both children get the clipped part on their side.
+            SbvhReference leftPart = reference;
+            SbvhReference rightPart = reference;
+            bool hasLeftPart = clipReference(reference, split.axis, reference.min[split.axis], split.position,
+                                             leftPart.min, leftPart.max);
+            bool hasRightPart = clipReference(reference, split.axis, split.position, reference.max[split.axis],
+                                              rightPart.min, rightPart.max);
+            if (hasLeftPart) {
+                left.push_back(leftPart);
+            }
+            if (hasRightPart) {
+                right.push_back(rightPart);
+            }
+        }
+    }
+}
+
+bool SplitBvhBuilder::clipReference(const SbvhReference &reference, int axis, float low, float high,
+                                    glm::vec3 &clippedMin, glm::vec3 &clippedMax) const {
+    const glm::uvec3 &triangle = (*primitives.indices)[reference.triangle];
+    glm::vec3 vertices[3] = {glm::vec3(coordinates[triangle.x]), glm::vec3(coordinates[triangle.y]),
+                             glm::vec3(coordinates[triangle.z])};
+
+    clippedMin = glm::vec3(99999, 99999, 99999);
+    clippedMax = glm::vec3(-99999, -99999, -99999);
+
+    // The vertices inside the slab and the points where the edges cross its planes bound the clipped polygon.
+    for (int i = 0; i < 3; i++) {
+        const glm::vec3 &start = vertices[i];
+        const glm::vec3 &end = vertices[(i + 1) % 3];
+
+        if (start[axis] >= low && start[axis] <= high) {
+            clippedMin = glm::min(clippedMin, start);
+            clippedMax = glm::max(clippedMax, start);
+        }
+
+        for (float plane : {low, high}) {
+            if ((start[axis] < plane && end[axis] > plane) || (start[axis] > plane && end[axis] < plane)) {
+                glm::vec3 crossing = glm::mix(start, end, (plane - start[axis]) / (end[axis] - start[axis]));
+                crossing[axis] = plane;
+                clippedMin = glm::min(clippedMin, crossing);
+                clippedMax = glm::max(clippedMax, crossing);
+            }
+        }
+    }
+
+    clippedMin = glm::max(clippedMin, reference.min);
+    clippedMax = glm::min(clippedMax, reference.max);
+    return glm::all(glm::lessThanEqual(clippedMin, clippedMax));
+}
+
+vector<int> &SplitBvhBuilder::getTriangleIndices() {
+    return triangleIndices;
+}
+
+int SplitBvhBuilder::getNumberOfReferences() const {
+    return numberOfReferences;
+}
+
+int SplitBvhBuilder::getNumberOfSpatialSplits() const {
+    return numberOfSpatialSplits;
+}
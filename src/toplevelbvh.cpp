@@ -0,0 +1,118 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <algorithm>
+
+#include "../includes/toplevelbvh.h"
+
+Instance TopLevelBvh::makeInstance(const glm::mat4 &objectToWorld, int rootNode) {
+    Instance instance;
+    instance.objectToWorld = objectToWorld;
+    instance.worldToObject = glm::inverse(objectToWorld);
+    instance.rootNode = rootNode;
+    instance.padding[0] = instance.padding[1] = instance.padding[2] = 0;
+    return instance;
+}
+
+void TopLevelBvh::getWorldBounds(const Instance &instance, const vector<FlatBvhNode> &bottomNodes,
+                                 glm::vec3 &worldMin, glm::vec3 &worldMax) {
+    glm::vec3 objectMin = bottomNodes[instance.rootNode].getMin();
+    glm::vec3 objectMax = bottomNodes[instance.rootNode].getMax();
+
+    worldMin = glm::vec3(99999, 99999, 99999);
+    worldMax = glm::vec3(-99999, -99999, -99999);
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 point(corner & 1 ? objectMax.x : objectMin.x, corner & 2 ? objectMax.y : objectMin.y,
+                        corner & 4 ? objectMax.z : objectMin.z);
+        glm::vec3 transformed(instance.objectToWorld * glm::vec4(point, 1.0f));
+        worldMin = glm::min(worldMin, transformed);
+        worldMax = glm::max(worldMax, transformed);
+    }
+}
+
+vector<FlatBvhNode> TopLevelBvh::build(vector<Instance> &instances, const vector<FlatBvhNode> &bottomNodes) {
+    vector<glm::vec3> boxMin(instances.size());
+    vector<glm::vec3> boxMax(instances.size());
+    for (int i = 0; i < instances.size(); i++) {
+        getWorldBounds(instances[i], bottomNodes, boxMin[i], boxMax[i]);
+    }
+
+    vector<int> instanceOrder(instances.size());
+    for (int i = 0; i < instances.size(); i++) {
+        instanceOrder[i] = i;
+    }
+
+    BvhNodeArena arena;
+    BvhNode *root = arena.allocate(1);
+    buildNode(root, instanceOrder, 0, instances.size(), boxMin, boxMax, 0, arena);
+    vector<FlatBvhNode> topNodes = FlatBvhNode::putNodeIntoArray(*root);
+
+    // The leaves are ranges of the instance order, the instances are put into that order like the triangles.
+    vector<Instance> orderedInstances(instances.size());
+    for (int i = 0; i < instanceOrder.size(); i++) {
+        orderedInstances[i] = instances[instanceOrder[i]];
+    }
+    instances.swap(orderedInstances);
+    return topNodes;
+}
+
+// Median split of the instances along the longest axis of their centers, an instance per leaf.
+void TopLevelBvh::buildNode(BvhNode *node, vector<int> &instanceOrder, int begin, int end,
+                            const vector<glm::vec3> &boxMin, const vector<glm::vec3> &boxMax, int depth,
+                            BvhNodeArena &arena) {
+    glm::vec3 nodeMin(99999, 99999, 99999);
+    glm::vec3 nodeMax(-99999, -99999, -99999);
+    glm::vec3 centerMin(99999, 99999, 99999);
+    glm::vec3 centerMax(-99999, -99999, -99999);
+    for (int i = begin; i < end; i++) {
+        int instance = instanceOrder[i];
+        nodeMin = glm::min(nodeMin, boxMin[instance]);
+        nodeMax = glm::max(nodeMax, boxMax[instance]);
+        centerMin = glm::min(centerMin, (boxMin[instance] + boxMax[instance]) * 0.5f);
+        centerMax = glm::max(centerMax, (boxMin[instance] + boxMax[instance]) * 0.5f);
+    }
+
+    node->setBBox(BBox(nodeMin, nodeMax, (centerMin + centerMax) * 0.5f));
+    node->setDepthOfNode(depth);
+
+    if (end - begin <= 1) {
+        node->setIsLeaf(true);
+        node->setFirstIndex(begin);
+        node->setIndexCount(end - begin);
+        return;
+    }
+
+    glm::vec3 extent = centerMax - centerMin;
+    int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+    int middle = (begin + end) / 2;
+    nth_element(instanceOrder.begin() + begin, instanceOrder.begin() + middle, instanceOrder.begin() + end,
+                [&](int a, int b) { return boxMin[a][axis] + boxMax[a][axis] < boxMin[b][axis] + boxMax[b][axis]; });
+
+    BvhNode *left = arena.allocate(2);
+    BvhNode *right = left + 1;
+    buildNode(left, instanceOrder, begin, middle, boxMin, boxMax, depth + 1, arena);
+    buildNode(right, instanceOrder, middle, end, boxMin, boxMax, depth + 1, arena);
+    left->setLeftOrRight(0);
+    right->setLeftOrRight(1);
+
+    node->setIsLeaf(false);
+    node->setChildren(left, right);
+}
+
+void TopLevelBvh::traceForStatistics(const vector<FlatBvhNode> &topNodes, const vector<Instance> &instances,
+                                     const vector<FlatBvhNode> &bottomNodes, const vector<TriangleRecord> &leafRecords,
+                                     const Ray &ray, float &closestT, int &visitedNodes, int &testedTriangles) {
+    int testedInstances = 0;
+    FlatBvhNode::traverse(topNodes, ray, closestT, visitedNodes, testedInstances, [&](int j) {
+        const Instance &instance = instances[j];
+        Ray objectRay;
+        objectRay.orig = glm::vec3(instance.worldToObject * glm::vec4(ray.orig, 1.0f));
+        objectRay.dir = glm::vec3(instance.worldToObject * glm::vec4(ray.dir, 0.0f));
+
+        float t = closestT;
+        FlatBvhNode::traceForStatistics(bottomNodes, leafRecords, objectRay, t, visitedNodes, testedTriangles,
+                                        instance.rootNode);
+        return t < closestT ? t : -1.0f;
+    });
+}
@@ -0,0 +1,198 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <cmath>
+#include <future>
+
+#include "../includes/treeletoptimizer.h"
+#include "../includes/bvhnode.h"
+
+TreeletOptimizer::TreeletOptimizer(const BvhSettings &settings)
+        : settings(settings),
+          timedOut(false),
+          restructuredTreelets(0),
+          spawnDepth(0) {
+    // The two subtrees of the top levels are optimized on two threads, enough levels to keep every thread busy.
+    if (settings.buildThreads > 1) {
+        spawnDepth = int(ceil(log2(float(settings.buildThreads)))) + 1;
+    }
+}
+
+void TreeletOptimizer::optimize(BvhNode *root, vector<int> &triangleIndices) {
+    subtreeCosts.assign(root->countSubtreeNodes(), 0);
+    deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::duration<float, milli>(settings.treeletTimeBudget));
+
+    for (int pass = 0; pass < settings.treeletPasses && !timedOut; pass++) {
+        int restructuredBefore = restructuredTreelets;
+        optimizeSubtree(root, 0);
+        if (restructuredTreelets == restructuredBefore) {
+            break;
+        }
+    }
+
+    vector<int> reorderedIndices;
+    reorderedIndices.reserve(triangleIndices.size());
+    renumber(root, root->getDepthOfNode(), 0, triangleIndices, reorderedIndices);
+    triangleIndices.swap(reorderedIndices);
+}
+
+void TreeletOptimizer::optimizeSubtree(BvhNode *node, int depth) {
+    if (timedOut) {
+        return;
+    }
+    if (node->getIsLeaf()) {
+        subtreeCosts[node->getOrder()] =
+                settings.intersectionCost * node->getBBox().getSurfaceArea() * node->getIndexCount();
+        return;
+    }
+
+    BvhNode *left = node->getChild(0);
+    BvhNode *right = node->getChild(1);
+    if (depth < spawnDepth) {
+        future<void> leftTask = async(launch::async, &TreeletOptimizer::optimizeSubtree, this, left, depth + 1);
+        optimizeSubtree(right, depth + 1);
+        leftTask.get();
+    } else {
+        optimizeSubtree(left, depth + 1);
+        optimizeSubtree(right, depth + 1);
+    }
+
+    // Once the time is up, the rest of the tree is left as it is.
+    if (timedOut || chrono::steady_clock::now() > deadline) {
+        timedOut = true;
+        return;
+    }
+
+    subtreeCosts[node->getOrder()] = settings.traversalCost * node->getBBox().getSurfaceArea() +
+                                     subtreeCosts[left->getOrder()] + subtreeCosts[right->getOrder()];
+    restructureTreelet(node);
+}
+
+void TreeletOptimizer::restructureTreelet(BvhNode *root) {
+    Treelet treelet;
+    treelet.leafCount = 0;
+    treelet.innerNodeCount = 0;
+    treelet.leaves[treelet.leafCount++] = root->getChild(0);
+    treelet.leaves[treelet.leafCount++] = root->getChild(1);
+
+    while (treelet.leafCount < settings.treeletLeaves) {
+        int largest = -1;
+        float largestArea = -1;
+        for (int i = 0; i < treelet.leafCount; i++) {
+            float area = treelet.leaves[i]->getBBox().getSurfaceArea();
+            if (!treelet.leaves[i]->getIsLeaf() && area > largestArea) {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest == -1) {
+            break;
+        }
+
+        BvhNode *opened = treelet.leaves[largest];
+        treelet.innerNodes[treelet.innerNodeCount++] = opened;
+        treelet.leaves[largest] = opened->getChild(0);
+        treelet.leaves[treelet.leafCount++] = opened->getChild(1);
+    }
+
+    // Two leaves have only one topology.
+    if (treelet.leafCount < 3) {
+        return;
+    }
+
+    findOptimalPartitions(treelet);
+
+    int allLeaves = (1 << treelet.leafCount) - 1;
+    if (treelet.costs[allLeaves] < subtreeCosts[root->getOrder()] * (1 - 1e-5f)) {
+        int nextInnerNode = 0;
+        rebuildTreelet(treelet, allLeaves, root, nextInnerNode);
+        restructuredTreelets++;
+    }
+}
+
+void TreeletOptimizer::findOptimalPartitions(Treelet &treelet) {
+    for (int i = 0; i < treelet.leafCount; i++) {
+        const BvhNode *leaf = treelet.leaves[i];
+        treelet.boundsMin[1 << i] = leaf->getBBox().getMin();
+        treelet.boundsMax[1 << i] = leaf->getBBox().getMax();
+        treelet.costs[1 << i] = subtreeCosts[leaf->getOrder()];
+    }
+
+    // Every proper subset of a set is a smaller number, so the subsets are ready by the time a set is reached.
+    int allLeaves = (1 << treelet.leafCount) - 1;
+    for (int subset = 1; subset <= allLeaves; subset++) {
+        if ((subset & (subset - 1)) == 0) {
+            continue;
+        }
+
+        int lowestLeaf = subset & -subset;
+        int rest = subset ^ lowestLeaf;
+        treelet.boundsMin[subset] = glm::min(treelet.boundsMin[rest], treelet.boundsMin[lowestLeaf]);
+        treelet.boundsMax[subset] = glm::max(treelet.boundsMax[rest], treelet.boundsMax[lowestLeaf]);
+
+        // Each split is taken once: 'part' is the side with the lowest leaf, 'rest' can't go to that side entirely.
+        float bestCost = 3.402823466e+38f;
+        int bestPartition = 0;
+        for (int other = (rest - 1) & rest;; other = (other - 1) & rest) {
+            int part = lowestLeaf | other;
+            float cost = treelet.costs[part] + treelet.costs[subset ^ part];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestPartition = part;
+            }
+            if (other == 0) {
+                break;
+            }
+        }
+
+        float area = BBox::getSurfaceArea(treelet.boundsMin[subset], treelet.boundsMax[subset]);
+        treelet.costs[subset] = settings.traversalCost * area + bestCost;
+        treelet.partitions[subset] = bestPartition;
+    }
+}
+
+BvhNode *TreeletOptimizer::rebuildTreelet(const Treelet &treelet, int subset, BvhNode *target, int &nextInnerNode) {
+    if ((subset & (subset - 1)) == 0) {
+        return treelet.leaves[__builtin_ctz(subset)];
+    }
+
+    BvhNode *node = target != nullptr ? target : treelet.innerNodes[nextInnerNode++];
+    int part = treelet.partitions[subset];
+    BvhNode *left = rebuildTreelet(treelet, part, nullptr, nextInnerNode);
+    BvhNode *right = rebuildTreelet(treelet, subset ^ part, nullptr, nextInnerNode);
+
+    const glm::vec3 &boundsMin = treelet.boundsMin[subset];
+    const glm::vec3 &boundsMax = treelet.boundsMax[subset];
+    node->setIsLeaf(false);
+    node->setChildren(left, right);
+    node->setBBox(BBox(boundsMin, boundsMax, (boundsMin + boundsMax) * 0.5f));
+    subtreeCosts[node->getOrder()] = treelet.costs[subset];
+    return node;
+}
+
+void TreeletOptimizer::renumber(BvhNode *node, int depth, int leftOrRight, const vector<int> &triangleIndices,
+                                vector<int> &reorderedIndices) {
+    node->setDepthOfNode(depth);
+    node->setLeftOrRight(leftOrRight);
+
+    if (node->getIsLeaf()) {
+        int firstIndex = node->getFirstIndex();
+        node->setFirstIndex(reorderedIndices.size());
+        reorderedIndices.insert(reorderedIndices.end(), triangleIndices.begin() + firstIndex,
+                                triangleIndices.begin() + firstIndex + node->getIndexCount());
+        return;
+    }
+
+    renumber(node->getChild(0), depth + 1, 0, triangleIndices, reorderedIndices);
+    renumber(node->getChild(1), depth + 1, 1, triangleIndices, reorderedIndices);
+}
+
+int TreeletOptimizer::getRestructuredTreelets() const {
+    return restructuredTreelets;
+}
+
+bool TreeletOptimizer::getTimedOut() const {
+    return timedOut;
+}
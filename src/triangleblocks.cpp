@@ -0,0 +1,211 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include <cstring>
+
+#include "../includes/triangleblocks.h"
+
+// The vectors of RayPacket and one of 4 floats, which is an xmm register of the SSE every x86-64 CPU has.
+typedef float Floats4 __attribute__((vector_size(16)));
+typedef int Ints4 __attribute__((vector_size(16)));
+typedef float Floats8 __attribute__((vector_size(32)));
+typedef int Ints8 __attribute__((vector_size(32)));
+typedef float Floats16 __attribute__((vector_size(64)));
+typedef int Ints16 __attribute__((vector_size(64)));
+
+/* The test of TriangleRecord::intersect on the lanes of the blocks, with the same operations in the same order, so a
+ * lane gets the distance of the single test. The padding triangles have no edges, their determinant is 0. The closest
+ * hit of a block is the one of the lowest lane among equal distances, as the tests one by one keep the first of them.
+ */
+template<typename Floats, typename Ints, int Width, bool AnyHit>
+static bool intersectBlocks(const float *block, int blockCount, int firstTriangle, const Ray &ray, float &closestT,
+                            int &triangle) {
+    for (int b = 0; b < blockCount; b++, block += 9 * Width) {
+        Floats pointAX, pointAY, pointAZ, pApBX, pApBY, pApBZ, pApCX, pApCY, pApCZ;
+        memcpy(&pointAX, block, sizeof(Floats));
+        memcpy(&pointAY, block + Width, sizeof(Floats));
+        memcpy(&pointAZ, block + 2 * Width, sizeof(Floats));
+        memcpy(&pApBX, block + 3 * Width, sizeof(Floats));
+        memcpy(&pApBY, block + 4 * Width, sizeof(Floats));
+        memcpy(&pApBZ, block + 5 * Width, sizeof(Floats));
+        memcpy(&pApCX, block + 6 * Width, sizeof(Floats));
+        memcpy(&pApCY, block + 7 * Width, sizeof(Floats));
+        memcpy(&pApCZ, block + 8 * Width, sizeof(Floats));
+
+        Floats vec90X = ray.dir.y * pApCZ - pApCY * ray.dir.z;
+        Floats vec90Y = ray.dir.z * pApCX - pApCZ * ray.dir.x;
+        Floats vec90Z = ray.dir.x * pApCY - pApCX * ray.dir.y;
+        Floats determinant = vec90X * pApBX + vec90Y * pApBY + vec90Z * pApBZ;
+        Floats determinantInv = 1 / determinant;
+
+        Floats vecTX = ray.orig.x - pointAX;
+        Floats vecTY = ray.orig.y - pointAY;
+        Floats vecTZ = ray.orig.z - pointAZ;
+        Floats u = determinantInv * (vecTX * vec90X + vecTY * vec90Y + vecTZ * vec90Z);
+
+        Floats vecQX = vecTY * pApBZ - pApBY * vecTZ;
+        Floats vecQY = vecTZ * pApBX - pApBZ * vecTX;
+        Floats vecQZ = vecTX * pApBY - pApBX * vecTY;
+        Floats v = determinantInv * (vecQX * ray.dir.x + vecQY * ray.dir.y + vecQZ * ray.dir.z);
+        Floats t = (pApCX * vecQX + pApCY * vecQY + pApCZ * vecQZ) * determinantInv;
+
+        Ints missed = (determinant == 0) | (u < 0) | (u > 1) | (v < 0) | (u + v > 1);
+        Ints closer = ~missed & (t > 0) & (t < closestT);
+
+        // Most blocks have no hit, that is checked on pairs of lanes before the lanes are looked at one by one.
+        long long closerPairs[Width / 2];
+        memcpy(closerPairs, &closer, sizeof(Ints));
+        long long anyCloser = 0;
+        for (int r = 0; r < Width / 2; r++) {
+            anyCloser |= closerPairs[r];
+        }
+        if (anyCloser == 0) {
+            continue;
+        }
+        for (int r = 0; r < Width; r++) {
+            if (closer[r] && t[r] < closestT) {
+                if (AnyHit) {
+                    return true;
+                }
+                closestT = t[r];
+                triangle = firstTriangle + b * Width + r;
+            }
+        }
+    }
+    return false;
+}
+
+// The instantiations take the target of their region, as in raypacket.cpp.
+template bool intersectBlocks<Floats4, Ints4, 4, false>(const float *block, int blockCount, int firstTriangle,
+                                                        const Ray &ray, float &closestT, int &triangle);
+template bool intersectBlocks<Floats4, Ints4, 4, true>(const float *block, int blockCount, int firstTriangle,
+                                                       const Ray &ray, float &closestT, int &triangle);
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+template bool intersectBlocks<Floats8, Ints8, 8, false>(const float *block, int blockCount, int firstTriangle,
+                                                        const Ray &ray, float &closestT, int &triangle);
+template bool intersectBlocks<Floats8, Ints8, 8, true>(const float *block, int blockCount, int firstTriangle,
+                                                       const Ray &ray, float &closestT, int &triangle);
+#pragma GCC pop_options
+
+// Without fused multiply-adds, like the packets of 16 rays.
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+template bool intersectBlocks<Floats16, Ints16, 16, false>(const float *block, int blockCount, int firstTriangle,
+                                                           const Ray &ray, float &closestT, int &triangle);
+template bool intersectBlocks<Floats16, Ints16, 16, true>(const float *block, int blockCount, int firstTriangle,
+                                                          const Ray &ray, float &closestT, int &triangle);
+#pragma GCC pop_options
+
+TriangleBlocks::TriangleBlocks() : width(0) {
+}
+
+TriangleBlocks::TriangleBlocks(const vector<FlatBvhNode> &nodes, const vector<TriangleRecord> &leafRecords, int width)
+        : width(width),
+          nodeBlocks(nodes.size(), -1) {
+    int blockCount = 0;
+    for (int i = 0; i < nodes.size(); i++) {
+        if (nodes[i].getIndexCount() > 0) {
+            nodeBlocks[i] = blockCount;
+            blockCount += (nodes[i].getIndexCount() + width - 1) / width;
+        }
+    }
+
+    blocks.assign(size_t(blockCount) * 9 * width, 0.0f);
+    for (int i = 0; i < nodes.size(); i++) {
+        for (int k = 0; k < nodes[i].getIndexCount(); k++) {
+            const TriangleRecord &record = leafRecords[nodes[i].getFirstIndex() + k];
+            float *block = &blocks[size_t(nodeBlocks[i] + k / width) * 9 * width];
+            int lane = k % width;
+            for (int axis = 0; axis < 3; axis++) {
+                block[axis * width + lane] = record.pointA[axis];
+                block[(3 + axis) * width + lane] = record.edgeAB[axis];
+                block[(6 + axis) * width + lane] = record.edgeAC[axis];
+            }
+        }
+    }
+}
+
+int TriangleBlocks::getWidth() {
+    static const int width = __builtin_cpu_supports("avx512f") ? 16 : __builtin_cpu_supports("avx2") ? 8 : 4;
+    return width;
+}
+
+int TriangleBlocks::chooseWidth(const vector<FlatBvhNode> &nodes) {
+    int largestLeaf = 0;
+    for (const FlatBvhNode &node : nodes) {
+        largestLeaf = MAX(largestLeaf, node.getIndexCount());
+    }
+    // The tests one by one stop early at most triangles, the blocks pay off from about 8 triangles in a leaf.
+    if (largestLeaf <= 4) {
+        return 0;
+    }
+    for (int width = 8; width < getWidth(); width *= 2) {
+        if (largestLeaf <= width) {
+            return width;
+        }
+    }
+    return getWidth();
+}
+
+int TriangleBlocks::getBlockWidth() const {
+    return width;
+}
+
+template<bool AnyHit>
+bool TriangleBlocks::intersectLeaf(const FlatBvhNode &node, int i, const Ray &ray, float &closestT,
+                                   int &triangle) const {
+    const float *block = &blocks[size_t(nodeBlocks[i]) * 9 * width];
+    int blockCount = (node.getIndexCount() + width - 1) / width;
+    if (width == 16) {
+        return intersectBlocks<Floats16, Ints16, 16, AnyHit>(block, blockCount, node.getFirstIndex(), ray, closestT,
+                                                             triangle);
+    } else if (width == 8) {
+        return intersectBlocks<Floats8, Ints8, 8, AnyHit>(block, blockCount, node.getFirstIndex(), ray, closestT,
+                                                          triangle);
+    }
+    return intersectBlocks<Floats4, Ints4, 4, AnyHit>(block, blockCount, node.getFirstIndex(), ray, closestT,
+                                                      triangle);
+}
+
+void TriangleBlocks::trace(const vector<FlatBvhNode> &nodes, const Ray &ray, int rootNode, float &closestT,
+                           int &triangle) const {
+    int i = rootNode;
+    while (i != -1) {
+        const FlatBvhNode &node = nodes[i];
+        float entryT;
+        if (!rayIntersectWithBox(node.getMin(), node.getMax(), ray, closestT, entryT)) {
+            i = node.getMissLink();
+            continue;
+        }
+        if (node.getIndexCount() > 0) {
+            intersectLeaf<false>(node, i, ray, closestT, triangle);
+        }
+        i = node.getHitLink();
+    }
+}
+
+bool TriangleBlocks::isOccluded(const vector<FlatBvhNode> &nodes, const Ray &ray, int rootNode,
+                                long &visitedNodes) const {
+    // The shadow rays look for any hit in front of them, as FlatBvhNode::traverseAnyHit does.
+    float maxT = 3.402823466e+38f;
+    int triangle = -1;
+    int i = rootNode;
+    while (i != -1) {
+        const FlatBvhNode &node = nodes[i];
+        visitedNodes++;
+        float entryT;
+        if (!rayIntersectWithBox(node.getMin(), node.getMax(), ray, maxT, entryT)) {
+            i = node.getMissLink();
+            continue;
+        }
+        if (node.getIndexCount() > 0 && intersectLeaf<true>(node, i, ray, maxT, triangle)) {
+            return true;
+        }
+        i = node.getHitLink();
+    }
+    return false;
+}
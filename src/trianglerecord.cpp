@@ -0,0 +1,84 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#include "../includes/trianglerecord.h"
+
+TriangleRecord::TriangleRecord(const glm::vec3 &pointA, const glm::vec3 &pointB, const glm::vec3 &pointC) {
+    glm::vec3 pApB = pointB - pointA;
+    glm::vec3 pApC = pointC - pointA;
+    glm::vec3 normal = glm::cross(pApB, pApC);
+    float length = glm::length(normal);
+    normal = length > 0 ? normal / length : glm::vec3(0, 0, 0);
+
+    this->pointA = glm::vec4(pointA, normal.x);
+    this->edgeAB = glm::vec4(pApB, normal.y);
+    this->edgeAC = glm::vec4(pApC, normal.z);
+}
+
+glm::vec3 TriangleRecord::getNormal() const {
+    return glm::vec3(pointA.w, edgeAB.w, edgeAC.w);
+}
+
+float TriangleRecord::intersect(const Ray &ray) const {
+    glm::vec3 pApB(edgeAB);
+    glm::vec3 pApC(edgeAC);
+    glm::vec3 vec90 = glm::cross(ray.dir, pApC);
+    float determinant = glm::dot(vec90, pApB);
+
+    if (determinant == 0) {
+        return -1;
+    }
+    float determinantInv = 1 / determinant;
+
+    glm::vec3 vecT = ray.orig - glm::vec3(pointA);
+    float u = determinantInv * glm::dot(vecT, vec90);
+    if (u < 0 || u > 1) {
+        return -1;
+    }
+
+    glm::vec3 vecQ = glm::cross(vecT, pApB);
+    float v = determinantInv * glm::dot(vecQ, ray.dir);
+    if (v < 0 || u + v > 1) {
+        return -1;
+    }
+
+    float t = glm::dot(pApC, vecQ) * determinantInv;
+    return t > 0 ? t : -1;
+}
+
+glm::vec2 TriangleRecord::getBarycentrics(const Ray &ray) const {
+    glm::vec3 pApB(edgeAB);
+    glm::vec3 pApC(edgeAC);
+    glm::vec3 vec90 = glm::cross(ray.dir, pApC);
+    float determinantInv = 1 / glm::dot(vec90, pApB);
+
+    glm::vec3 vecT = ray.orig - glm::vec3(pointA);
+    glm::vec3 vecQ = glm::cross(vecT, pApB);
+    return glm::vec2(determinantInv * glm::dot(vecT, vec90), determinantInv * glm::dot(vecQ, ray.dir));
+}
+
+vector<TriangleRecord> TriangleRecord::buildRecords(const vector<glm::uvec3> &triangles,
+                                                    const vector<glm::vec4> &coordinates) {
+    vector<TriangleRecord> records;
+    records.reserve(triangles.size());
+    for (const glm::uvec3 &triangle : triangles) {
+        records.emplace_back(glm::vec3(coordinates[triangle.x]), glm::vec3(coordinates[triangle.y]),
+                             glm::vec3(coordinates[triangle.z]));
+    }
+    return records;
+}
+
+void TriangleRecord::updateRecords(vector<TriangleRecord> &records, const vector<glm::uvec3> &triangles,
+                                   const vector<glm::vec4> &coordinates, const vector<char> &movedVertices,
+                                   vector<char> &changedRecords) {
+    changedRecords.assign(records.size(), 0);
+    for (int i = 0; i < triangles.size(); i++) {
+        const glm::uvec3 &triangle = triangles[i];
+        if (movedVertices[triangle.x] || movedVertices[triangle.y] || movedVertices[triangle.z]) {
+            records[i] = TriangleRecord(glm::vec3(coordinates[triangle.x]), glm::vec3(coordinates[triangle.y]),
+                                        glm::vec3(coordinates[triangle.z]));
+            changedRecords[i] = 1;
+        }
+    }
+}
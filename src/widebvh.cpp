@@ -0,0 +1,167 @@
+//
+// Created by fox1942 on 10/16/26.
+//
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "../includes/widebvh.h"
+
+template<int Width>
+vector<WideBvhNode<Width>> WideBvh<Width>::collapse(const BvhNode &root) {
+    vector<WideBvhNode<Width>> nodes;
+    // The wide tree has at most a third of the binary nodes with four children, a seventh with eight.
+    nodes.reserve(root.countSubtreeNodes() / (Width - 1) + 1);
+    collapseNode(root, nodes);
+    return nodes;
+}
+
+template<int Width>
+int WideBvh<Width>::collapseNode(const BvhNode &node, vector<WideBvhNode<Width>> &nodes) {
+    array<const BvhNode *, Width> children;
+    int childCount = 0;
+
+    if (node.getIsLeaf()) {
+        // Only a tree that is a single leaf gets here, its root holds the leaf as its only child.
+        children[childCount++] = &node;
+    } else {
+        children[childCount++] = node.getChild(0);
+        children[childCount++] = node.getChild(1);
+    }
+
+    while (childCount < Width) {
+        int largest = -1;
+        float largestArea = -1;
+        for (int i = 0; i < childCount; i++) {
+            float area = children[i]->getBBox().getSurfaceArea();
+            if (!children[i]->getIsLeaf() && area > largestArea) {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest == -1) {
+            break;
+        }
+
+        const BvhNode *opened = children[largest];
+        children[largest] = opened->getChild(0);
+        children[childCount++] = opened->getChild(1);
+    }
+
+    int index = nodes.size();
+    nodes.emplace_back();
+
+    for (int i = 0; i < Width; i++) {
+        WideBvhNode<Width> &wideNode = nodes[index];
+        if (i >= childCount) {
+            wideNode.minX[i] = wideNode.minY[i] = wideNode.minZ[i] = 0;
+            wideNode.maxX[i] = wideNode.maxY[i] = wideNode.maxZ[i] = 0;
+            wideNode.child[i] = -1;
+            wideNode.count[i] = -1;
+            continue;
+        }
+
+        const BBox &bBox = children[i]->getBBox();
+        wideNode.minX[i] = bBox.getMin().x;
+        wideNode.minY[i] = bBox.getMin().y;
+        wideNode.minZ[i] = bBox.getMin().z;
+        wideNode.maxX[i] = bBox.getMax().x;
+        wideNode.maxY[i] = bBox.getMax().y;
+        wideNode.maxZ[i] = bBox.getMax().z;
+
+        if (children[i]->getIsLeaf()) {
+            wideNode.child[i] = children[i]->getFirstIndex();
+            wideNode.count[i] = children[i]->getIndexCount();
+        } else {
+            // 'nodes' grows in the recursion, so the node is looked up again by its index.
+            int childIndex = collapseNode(*children[i], nodes);
+            nodes[index].child[i] = childIndex;
+            nodes[index].count[i] = 0;
+        }
+    }
+    return index;
+}
+
+template<int Width>
+int WideBvh<Width>::getStackSize(const vector<WideBvhNode<Width>> &nodes) {
+    // The children follow their parent in the pre-order, so walking backwards meets them first.
+    vector<int> stackSizes(nodes.size());
+    for (int index = nodes.size() - 1; index >= 0; index--) {
+        const WideBvhNode<Width> &node = nodes[index];
+        int childCount = 0;
+        int deepestChild = 0;
+        for (int i = 0; i < Width; i++) {
+            if (node.count[i] < 0) {
+                continue;
+            }
+            childCount++;
+            if (node.count[i] == 0) {
+                deepestChild = MAX(deepestChild, stackSizes[node.child[i]]);
+            }
+        }
+        stackSizes[index] = MAX(childCount, childCount - 1 + deepestChild);
+    }
+    return nodes.empty() ? 0 : stackSizes[0];
+}
+
+template<int Width>
+int WideBvh<Width>::intersectChildren(const WideBvhNode<Width> &node, const Ray &ray, const glm::vec3 &invDir,
+                                      float maxT, float entryT[Width]) {
+    int hitMask = 0;
+#if defined(__SSE__)
+    const __m128 origX = _mm_set1_ps(ray.orig.x);
+    const __m128 origY = _mm_set1_ps(ray.orig.y);
+    const __m128 origZ = _mm_set1_ps(ray.orig.z);
+    const __m128 invDirX = _mm_set1_ps(invDir.x);
+    const __m128 invDirY = _mm_set1_ps(invDir.y);
+    const __m128 invDirZ = _mm_set1_ps(invDir.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 rayMaxT = _mm_set1_ps(maxT);
+
+    // The same slab test as rayIntersectWithBox, for four children at once.
+    for (int group = 0; group < Width; group += 4) {
+        __m128 nearX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX + group), origX), invDirX);
+        __m128 farX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX + group), origX), invDirX);
+        __m128 nearY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY + group), origY), invDirY);
+        __m128 farY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY + group), origY), invDirY);
+        __m128 nearZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ + group), origZ), invDirZ);
+        __m128 farZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ + group), origZ), invDirZ);
+
+        __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(nearX, farX), _mm_min_ps(nearY, farY)),
+                                  _mm_max_ps(_mm_min_ps(nearZ, farZ), zero));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(nearX, farX), _mm_max_ps(nearY, farY)),
+                                 _mm_min_ps(_mm_max_ps(nearZ, farZ), rayMaxT));
+
+        _mm_storeu_ps(entryT + group, enter);
+        hitMask |= _mm_movemask_ps(_mm_cmple_ps(enter, exit)) << group;
+    }
+#else
+    for (int i = 0; i < Width; i++) {
+        glm::vec3 boxMin(node.minX[i], node.minY[i], node.minZ[i]);
+        glm::vec3 boxMax(node.maxX[i], node.maxY[i], node.maxZ[i]);
+        if (rayIntersectWithBox(boxMin, boxMax, ray, maxT, entryT[i])) {
+            hitMask |= 1 << i;
+        }
+    }
+#endif
+
+    // The empty slots are masked out, their bounds are not meant to be hit.
+    for (int i = 0; i < Width; i++) {
+        if (node.count[i] < 0) {
+            hitMask &= ~(1 << i);
+        }
+    }
+    return hitMask;
+}
+
+template<int Width>
+void WideBvh<Width>::traceForStatistics(const vector<WideBvhNode<Width>> &nodes,
+                                        const vector<TriangleRecord> &leafRecords, const Ray &ray, float &closestT,
+                                        int &visitedNodes, int &testedTriangles) {
+    traverse(leafRecords, ray, closestT, visitedNodes, testedTriangles,
+             [&](int index) -> const WideBvhNode<Width> & { return nodes[index]; });
+}
+
+template class WideBvh<4>;
+template class WideBvh<8>;